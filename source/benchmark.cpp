@@ -0,0 +1,169 @@
+#include "sfml/system.hpp"
+
+#include "tileGenerator.hpp"
+#include "world.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//Headless world generation benchmark, no window or sound.
+//usage: benchmark [baseline file] [--save] [--threads <workers>] [--depth <n>] [--branches <n>]
+//	[--lazy]
+//Generates a world for every seed at every size and prints the mean time of each phase.
+//Given a baseline file from an earlier run on the same machine, it exits with 1
+//if a phase got slower than TOLERANCE allows or a world came out different.
+//With --save, or if the baseline doesn't exist yet, the results become the baseline.
+//With --threads, caves are carved on a pool with that many workers.
+//--depth and --branches override the cave tree limits, worlds then won't match the baseline.
+//With --lazy, worlds are generated lazily, and the regions phase is generating every region.
+//Those worlds won't match a baseline of worlds that weren't.
+
+const unsigned SEEDS[]={ 1, 2, 3, 4, 5, 6, 7, 8 };
+const unsigned SIZES[]={ 128, 256, 512, 1024 };
+const float TOLERANCE=1.25f;//allowed slowdown factor
+const float SLACK=0.5f;//milliseconds, so that tiny phases don't fail on noise
+
+class Timer: public PhaseTimer{
+	public:
+		void start(){ clock.restart(); }
+		void phase(const char* name){
+			float ms=clock.restart().asMicroseconds()/1000.0f;
+			if(times.find(name)==times.end()) order.push_back(name);
+			times[name]+=ms;
+		}
+		map<string, float> times;//summed over seeds
+		vector<string> order;
+	private:
+		sf::Clock clock;
+};
+
+unsigned checksum(const World& world){
+	unsigned result=2166136261u;
+	const Tiles& tiles=world.tiles;
+	for(unsigned x=0; x<tiles.readW(); ++x)
+		for(unsigned y=0; y<tiles.readH(); ++y){
+			result=(result^tiles.at(x, y))*16777619u;
+			result=(result^unsigned(255*tiles.mondrianLAt(x, y)))*16777619u;
+			result=(result^unsigned(255*tiles.mondrianRAt(x, y)))*16777619u;
+			result=(result^unsigned(255*tiles.mondrianUAt(x, y)))*16777619u;
+			result=(result^unsigned(255*tiles.mondrianDAt(x, y)))*16777619u;
+		}
+	int positions[]={
+		world.playerX, world.playerY,
+		world.buddyX, world.buddyY,
+		world.scubaX, world.scubaY
+	};
+	for(unsigned i=0; i<sizeof(positions)/sizeof(int); ++i)
+		result=(result^positions[i])*16777619u;
+	for(unsigned i=0; i<world.hiJumps.size(); ++i){
+		result=(result^world.hiJumps[i].first)*16777619u;
+		result=(result^world.hiJumps[i].second)*16777619u;
+	}
+	return result;
+}
+
+string key(const string& phase, unsigned size){
+	stringstream ss;
+	ss<<phase<<" "<<size;
+	return ss.str();
+}
+
+int main(int argc, char** argv){
+	string baselineFileName;
+	bool save=false;
+	unsigned workers=0;
+	CaveTreeSettings caveTreeSettings;
+	bool lazy=false;
+	for(int i=1; i<argc; ++i){
+		if(string(argv[i])=="--save") save=true;
+		else if(string(argv[i])=="--lazy") lazy=true;
+		else if(string(argv[i])=="--threads"&&i+1<argc) workers=atoi(argv[++i]);
+		else if(string(argv[i])=="--depth"&&i+1<argc) caveTreeSettings.maxDepth=atoi(argv[++i]);
+		else if(string(argv[i])=="--branches"&&i+1<argc) caveTreeSettings.maxBranches=atoi(argv[++i]);
+		else baselineFileName=argv[i];
+	}
+	ThreadPool* pool=workers?new ThreadPool(workers):NULL;
+	//"<size> <milliseconds> <phase>" and "<size> checksum <checksum>" lines
+	map<string, float> baselineTimes;
+	map<unsigned, unsigned> baselineChecksums;
+	if(baselineFileName.size()&&!save){
+		ifstream file(baselineFileName.c_str());
+		if(!file) save=true;
+		string line;
+		while(getline(file, line)){
+			stringstream ss(line);
+			unsigned size;
+			string field;
+			ss>>size>>field;
+			if(field=="checksum") ss>>baselineChecksums[size];
+			else{
+				string phase;
+				getline(ss>>ws, phase);
+				baselineTimes[key(phase, size)]=(float)atof(field.c_str());
+			}
+		}
+	}
+	stringstream results;
+	bool regressed=false;
+	const unsigned seeds=sizeof(SEEDS)/sizeof(unsigned);
+	for(unsigned i=0; i<sizeof(SIZES)/sizeof(unsigned); ++i){
+		unsigned size=SIZES[i];
+		Timer timer;
+		unsigned sum=0, caves=0, rejections=0;
+		for(unsigned j=0; j<seeds; ++j){
+			World world;
+			world.caveTreeSettings=caveTreeSettings;
+			TileGenerator generator;
+			if(lazy){
+				world.generateLazily(SEEDS[j], size, size, generator, &timer);
+				sum=sum*31+checksum(world);
+				timer.phase("regions");
+			}
+			else{
+				world.generate(SEEDS[j], size, size, &timer, pool);
+				sum=sum*31+checksum(world);
+			}
+			caves+=world.caves.size();
+			rejections+=world.caveRejections;
+		}
+		cout<<size<<"x"<<size<<", mean of "<<seeds<<" seeds\n";
+		float total=0.0f;
+		for(unsigned j=0; j<timer.order.size(); ++j){
+			const string& phase=timer.order[j];
+			float ms=timer.times[phase]/seeds;
+			total+=ms;
+			results<<size<<" "<<ms<<" "<<phase<<"\n";
+			cout<<"\t"<<phase<<": "<<ms<<" ms";
+			if(baselineTimes.count(key(phase, size))){
+				float baseline=baselineTimes[key(phase, size)];
+				cout<<" (baseline "<<baseline<<" ms)";
+				if(ms>baseline*TOLERANCE+SLACK){
+					cout<<" REGRESSION";
+					regressed=true;
+				}
+			}
+			cout<<"\n";
+		}
+		cout<<"\ttotal: "<<total<<" ms\n";
+		cout<<"\tcaves: "<<1.0f*caves/seeds<<", rejected branches: "<<1.0f*rejections/seeds<<"\n";
+		results<<size<<" checksum "<<sum<<"\n";
+		if(baselineChecksums.count(size)&&baselineChecksums[size]!=sum){
+			cout<<"\tworlds differ from baseline\n";
+			regressed=true;
+		}
+	}
+	if(save&&baselineFileName.size()){
+		ofstream file(baselineFileName.c_str());
+		file<<results.str();
+		cout<<"saved baseline to "<<baselineFileName<<"\n";
+	}
+	delete pool;
+	return regressed?1:0;
+}
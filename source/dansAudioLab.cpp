@@ -4,6 +4,17 @@
 #include <algorithm>
 #include <cmath>
 
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sched.h>
+#endif
+
 using namespace dal;
 using namespace std;
 
@@ -452,14 +463,37 @@ string Midi::parse(vector<unsigned char>& bytes){
 Component& Component::operator>>(Component& other){
 	addOutput(other);
 	other.addInput(*this);
+	other.sources.push_back(this);
 	return other;
 }
 
 /*-----System-----*/
+//lets another thread have this core, such as a worker that's being waited on
+static void yieldThread(){
+	#ifdef _WIN32
+		SwitchToThread();
+	#else
+		sched_yield();
+	#endif
+}
+
 System::System(unsigned sampleRate, unsigned samplesAtOnce):
 	sampleRate(sampleRate),
-	samplesAtOnce(samplesAtOnce)
-{}
+	samplesAtOnce(samplesAtOnce),
+	settings(MAX_SETTINGS),
+	claims(0),
+	done(0),
+	workers(0),
+	wake(NULL),
+	wakeData(NULL),
+	budget(0.0),
+	worstEvaluate(0.0),
+	clock(NULL),
+	overruns(0),
+	lateWorkers(0)
+{
+	delayed.reserve(MAX_SETTINGS);
+}
 
 System::~System(){
 	for(unsigned i=0; i<components.size(); ++i) delete components[i];
@@ -477,11 +511,240 @@ void System::attachToOutput(Component& component){
 	samples=(float*)component.perform("samples", NULL);
 }
 
+System::Port System::port(const std::string& component, const std::string& parameter){
+	Port port;
+	std::map<std::string, Component*>::iterator i=componentsByName.find(component);
+	if(i==componentsByName.end()) return port;
+	port.parameter=i->second->parameter(parameter);
+	if(port.parameter!=Component::NO_PARAMETER) port.component=i->second;
+	return port;
+}
+
+bool System::set(const Port& port, float value, unsigned delay){
+	if(!port.component) return false;
+	Setting setting;
+	setting.port=port;
+	setting.value=value;
+	setting.delay=delay;
+	return settings.push(setting);
+}
+
 const float* System::evaluate(){
-	for(unsigned i=0; i<components.size(); ++i) components[i]->evaluate();
+	double start=clock?clock():0.0;
+	//hand out the settings due in this evaluate, in the order they came, keeping the rest
+	Setting setting;
+	while(delayed.size()<MAX_SETTINGS&&settings.pop(setting)) delayed.push_back(setting);
+	unsigned kept=0;
+	for(unsigned i=0; i<delayed.size(); ++i){
+		if(delayed[i].delay<samplesAtOnce){
+			const Port& port=delayed[i].port;
+			port.component->set(port.parameter, delayed[i].value, delayed[i].delay);
+		}
+		else{
+			delayed[kept]=delayed[i];
+			delayed[kept].delay-=samplesAtOnce;
+			++kept;
+		}
+	}
+	delayed.resize(kept);
+	bool sharing=workers!=0;
+	for(unsigned level=0, begin=0; level<levelEnds.size(); begin=levelEnds[level++]){
+		unsigned end=levelEnds[level];
+		if(!sharing||end-begin<MIN_SHARED||end>MAX_SHARED){
+			for(unsigned i=begin; i<end; ++i) ordered[i]->evaluate();
+			continue;
+		}
+		//open the level, wake workers, and claim along with them
+		done=0;
+		__sync_synchronize();
+		claims=end<<16|begin;
+		__sync_synchronize();
+		wake(wakeData, min(workers, end-begin-1));
+		unsigned i;
+		while(claim(i)){
+			ordered[i]->evaluate();
+			__sync_fetch_and_add(&done, 1);
+		}
+		//Everything's claimed, so this only waits on components being evaluated right now.
+		//It spins briefly, then yields in case their worker is waiting for this core. Past the
+		//budget, the rest of the levels are evaluated here instead of waiting on workers again.
+		for(unsigned spins=0; done<end-begin; ++spins){
+			if(spins<MAX_SPINS){
+				#ifdef __SSE2__
+					_mm_pause();
+				#endif
+			}
+			else yieldThread();
+			if(sharing&&clock&&clock()-start>budget){
+				sharing=false;
+				++lateWorkers;
+			}
+		}
+		__sync_synchronize();
+	}
+	if(clock){
+		double duration=clock()-start;
+		if(duration>budget) ++overruns;
+		if(duration>worstEvaluate) worstEvaluate=duration;
+	}
 	return samples;
 }
 
+bool System::work(){
+	unsigned i;
+	if(!claim(i)) return false;
+	do{
+		ordered[i]->evaluate();
+		__sync_fetch_and_add(&done, 1);
+	}while(claim(i));
+	return true;
+}
+
+void System::setWorkers(unsigned _workers, Wake _wake, void* data){
+	workers=_wake?_workers:0;
+	wake=_wake;
+	wakeData=data;
+}
+
+void System::setBudget(double seconds, Clock _clock){
+	budget=seconds;
+	clock=_clock;
+}
+
+unsigned System::build(){
+	unsigned cycles=0;
+	ordered.clear();
+	levelEnds.clear();
+	//each level is whatever has everything in the system it depends on in earlier levels
+	std::map<Component*, bool> placed;
+	for(unsigned i=0; i<components.size(); ++i) placed[components[i]]=false;
+	while(ordered.size()<components.size()){
+		std::vector<Component*> level;
+		for(unsigned i=0; i<components.size(); ++i){
+			if(placed[components[i]]) continue;
+			bool ready=true;
+			for(unsigned j=0; j<components[i]->sources.size(); ++j){
+				std::map<Component*, bool>::iterator source=placed.find(components[i]->sources[j]);
+				if(source!=placed.end()&&!source->second) ready=false;
+			}
+			if(ready) level.push_back(components[i]);
+		}
+		//Only cycles and what depends on them are left. Unplaced sources are followed back from
+		//anything unplaced until one repeats, which is on a cycle, and the cycle is broken at
+		//whichever of its components was added first.
+		if(level.empty()){
+			Component* at=NULL;
+			for(unsigned i=0; i<components.size()&&!at; ++i)
+				if(!placed[components[i]]) at=components[i];
+			std::vector<Component*> path;
+			while(std::find(path.begin(), path.end(), at)==path.end()){
+				path.push_back(at);
+				for(unsigned j=0; j<at->sources.size(); ++j){
+					std::map<Component*, bool>::iterator source=placed.find(at->sources[j]);
+					if(source!=placed.end()&&!source->second){
+						at=source->first;
+						break;
+					}
+				}
+			}
+			std::vector<Component*> cycle(std::find(path.begin(), path.end(), at), path.end());
+			for(unsigned i=0; i<components.size()&&level.empty(); ++i)
+				if(std::find(cycle.begin(), cycle.end(), components[i])!=cycle.end())
+					level.push_back(components[i]);
+			++cycles;
+		}
+		for(unsigned i=0; i<level.size(); ++i){
+			placed[level[i]]=true;
+			ordered.push_back(level[i]);
+		}
+		levelEnds.push_back(ordered.size());
+	}
+	return cycles;
+}
+
+//claims the next component of the shared level, false if they're all claimed
+bool System::claim(unsigned& i){
+	while(true){
+		unsigned state=claims;
+		i=state&0xffff;
+		if(i>=state>>16) return false;
+		if(__sync_bool_compare_and_swap(&claims, state, state+1)) return true;
+	}
+}
+
+/*=====Kernels=====*/
+void dal::mix(
+	const float* const* sources, unsigned count, float volume,
+	float* destination, unsigned begin, unsigned end
+){
+	unsigned i=begin;
+	#ifdef __SSE2__
+		const __m128 volumes=_mm_set1_ps(volume);
+		const __m128 lows=_mm_set1_ps(-1.0f), highs=_mm_set1_ps(1.0f);
+		for(; i+4<=end; i+=4){
+			__m128 sum=_mm_setzero_ps();
+			for(unsigned j=0; j<count; ++j)
+				sum=_mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(sources[j]+i), volumes));
+			_mm_storeu_ps(destination+i, _mm_min_ps(_mm_max_ps(sum, lows), highs));
+		}
+	#endif
+	for(; i<end; ++i){
+		float sum=0.0f;
+		for(unsigned j=0; j<count; ++j) sum+=sources[j][i]*volume;
+		if(sum<-1.0f) sum=-1.0f;
+		else if(sum>1.0f) sum=1.0f;
+		destination[i]=sum;
+	}
+}
+
+Dither::Dither(){
+	for(unsigned i=0; i<4; ++i) state[i]=0x9e3779b9*(i+1);
+}
+
+void dal::toInt16(
+	const float* samples, unsigned size, float scale, short* destination, Dither* dither
+){
+	unsigned i=0;
+	#ifdef __SSE2__
+		const __m128 scales=_mm_set1_ps(scale);
+		const __m128 lows=_mm_set1_ps(-1.0f), highs=_mm_set1_ps(1.0f);
+		const __m128 step=_mm_set1_ps(1.0f/65536);
+		const __m128i halves=_mm_set1_epi32(0xffff);
+		__m128i states=_mm_setzero_si128();
+		if(dither) states=_mm_loadu_si128((const __m128i*)dither->state);
+		for(; i+4<=size; i+=4){
+			__m128 x=_mm_min_ps(_mm_max_ps(_mm_loadu_ps(samples+i), lows), highs);
+			x=_mm_mul_ps(x, scales);
+			if(dither){
+				states=_mm_xor_si128(states, _mm_slli_epi32(states, 13));
+				states=_mm_xor_si128(states, _mm_srli_epi32(states, 17));
+				states=_mm_xor_si128(states, _mm_slli_epi32(states, 5));
+				__m128 a=_mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(states, halves)), step);
+				__m128 b=_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(states, 16)), step);
+				x=_mm_add_ps(x, _mm_sub_ps(a, b));
+			}
+			__m128i words=_mm_cvttps_epi32(x);
+			_mm_storel_epi64((__m128i*)(destination+i), _mm_packs_epi32(words, words));
+		}
+		if(dither) _mm_storeu_si128((__m128i*)dither->state, states);
+	#endif
+	for(; i<size; ++i){
+		float x=samples[i];
+		if(x<-1.0f) x=-1.0f;
+		else if(x>1.0f) x=1.0f;
+		x*=scale;
+		if(dither){
+			unsigned& state=dither->state[i&3];
+			state^=state<<13;
+			state^=state>>17;
+			state^=state<<5;
+			x+=float(state&0xffff)*(1.0f/65536)-float(state>>16)*(1.0f/65536);
+		}
+		int word=int(x);
+		destination[i]=word<-32768?-32768:word>32767?32767:word;
+	}
+}
+
 /*=====Controllers=====*/
 /*-----Notes-----*/
 void Notes::loadFromMidi(string fileName){
@@ -553,12 +816,21 @@ LFSRNoise::LFSRNoise(int decayLength): decayLength(decayLength) {}
 LFSRNoise::~LFSRNoise(){ delete samples; }
 
 void* LFSRNoise::perform(string action, void* data){
-	if(action=="iv") volume=*(float*)data;
-	else if(action=="volume") desiredVolume=*(float*)data;
-	else if(action=="samples") return samples;
+	if(action=="samples") return samples;
 	return NULL;
 }
 
+unsigned LFSRNoise::parameter(const string& name) const{
+	if(name=="iv") return INITIAL_VOLUME;
+	else if(name=="volume") return VOLUME;
+	return NO_PARAMETER;
+}
+
+void LFSRNoise::set(unsigned parameter, float value, unsigned offset){
+	if(parameter==INITIAL_VOLUME) volume=value;
+	else if(parameter==VOLUME) desiredVolume=value;
+}
+
 void LFSRNoise::initialize(unsigned sampleRate, unsigned samplesAtOnce){
 	samples=new float[samplesAtOnce];
 	size=samplesAtOnce;
@@ -584,20 +856,30 @@ void LFSRNoise::evaluate(){
 }
 
 /*-----Sonic-----*/
-Sonic::Sonic(float volume): volume(volume), desiredVolume(volume) {
+Sonic::Sonic(float volume, unsigned polyphony, Stealing stealing):
+	volume(volume), desiredVolume(volume), voices(polyphony), playing(0), stealing(stealing)
+{
 	notesDelegate.oscillators=oscillators;
-	notesDelegate.notes=&notes;
+	notesDelegate.sonic=this;
 }
 
 Sonic::~Sonic(){ delete samples; }
 
 void* Sonic::perform(string action, void* data){
-	if(action=="volume") desiredVolume=*(float*)data;
-	else if(action=="samples") return samples;
+	if(action=="samples") return samples;
 	else if(action=="delegate") return (Delegate*)&notesDelegate;
 	return NULL;
 }
 
+unsigned Sonic::parameter(const string& name) const{
+	if(name=="volume") return VOLUME;
+	return NO_PARAMETER;
+}
+
+void Sonic::set(unsigned parameter, float value, unsigned offset){
+	if(parameter==VOLUME) desiredVolume=value;
+}
+
 void Sonic::setOscillator(
 	unsigned oscillator, float frequencyMultiplier, float amplitude, float attack, float decay, float sustain, float release
 ){
@@ -625,34 +907,32 @@ void Sonic::initialize(unsigned sampleRate, unsigned samplesAtOnce){
 
 void Sonic::evaluate(){
 	volume=(volume*31+desiredVolume)/32;
-	for(unsigned i=0; i<size; ++i){
-		samples[i]=0.0f;
-		for(unsigned j=0; j<notes.size();){
-			++notes[j].age;
-			if(notes[j].age<0){
-				++j;
-				continue;
-			}
-			else if(notes[j].age==notes[j].duration)
+	for(unsigned i=0; i<size; ++i) samples[i]=0.0f;
+	for(unsigned j=0; j<playing; ++j){
+		Note& note=voices[j];
+		for(unsigned i=0; i<size&&!note.done; ++i){
+			++note.age;
+			if(note.age<0) continue;
+			else if(note.age==note.duration)
 				for(unsigned k=0; k<OSCILLATORS; ++k)
-					notes[j].runners[k].stage=Runner::RELEASE;
+					note.runners[k].stage=Runner::RELEASE;
 			bool done=true;
 			for(unsigned k=0; k<OSCILLATORS; ++k){
-				notes[j].runners[k].phase+=notes[j].runners[k].step;
-				switch(notes[j].runners[k].stage){
+				note.runners[k].phase+=note.runners[k].step;
+				switch(note.runners[k].stage){
 					case Runner::ATTACK:
-						notes[j].runners[k].amplitude+=oscillators[k].attack;
-						if(notes[j].runners[k].amplitude>1){
-							notes[j].runners[k].amplitude=1;
-							notes[j].runners[k].stage=Runner::DECAY;
+						note.runners[k].amplitude+=oscillators[k].attack;
+						if(note.runners[k].amplitude>1){
+							note.runners[k].amplitude=1;
+							note.runners[k].stage=Runner::DECAY;
 						}
 						if(oscillators[k].output) done=false;
 						break;
 					case Runner::DECAY:
-						notes[j].runners[k].amplitude-=oscillators[k].decay;
-						if(notes[j].runners[k].amplitude<oscillators[k].sustain){
-							notes[j].runners[k].amplitude=oscillators[k].sustain;
-							notes[j].runners[k].stage=Runner::SUSTAIN;
+						note.runners[k].amplitude-=oscillators[k].decay;
+						if(note.runners[k].amplitude<oscillators[k].sustain){
+							note.runners[k].amplitude=oscillators[k].sustain;
+							note.runners[k].stage=Runner::SUSTAIN;
 						}
 						if(oscillators[k].output) done=false;
 						break;
@@ -660,26 +940,53 @@ void Sonic::evaluate(){
 						if(oscillators[k].output) done=false;
 						break;
 					case Runner::RELEASE:
-						notes[j].runners[k].amplitude-=oscillators[k].release;
-						if(notes[j].runners[k].amplitude<0) notes[j].runners[k].amplitude=0;
+						note.runners[k].amplitude-=oscillators[k].release;
+						if(note.runners[k].amplitude<0) note.runners[k].amplitude=0;
 						else if(oscillators[k].output) done=false;
 						break;
 					default: break;
 				}
-				float modulatedPhase=notes[j].runners[k].phase;
+				float modulatedPhase=note.runners[k].phase;
 				for(unsigned l=0; l<OSCILLATORS; ++l)
-					modulatedPhase+=notes[j].runners[l].output*oscillators[k].inputs[l];
-				notes[j].runners[k].output=wave(modulatedPhase)*notes[j].runners[k].amplitude*oscillators[k].amplitude;
-				notes[j].runners[k].phase-=floor(notes[j].runners[k].phase);
-				if(oscillators[k].output) samples[i]+=notes[j].runners[k].output*notes[j].volume*volume;
-			}
-			if(done){
-				notes[j]=notes.back();
-				notes.pop_back();
+					modulatedPhase+=note.runners[l].output*oscillators[k].inputs[l];
+				note.runners[k].output=wave(modulatedPhase)*note.runners[k].amplitude*oscillators[k].amplitude;
+				note.runners[k].phase-=floor(note.runners[k].phase);
+				if(oscillators[k].output) samples[i]+=note.runners[k].output*note.volume*volume;
 			}
-			else ++j;
+			note.done=done;
 		}
 	}
+	//a finished voice only adds silence, so they're dropped once the block is done
+	unsigned kept=0;
+	for(unsigned j=0; j<playing; ++j)
+		if(!voices[j].done) voices[kept++]=voices[j];
+	playing=kept;
+}
+
+void Sonic::play(const Note& note){
+	if(voices.empty()) return;
+	if(playing<voices.size()){
+		voices[playing++]=note;
+		return;
+	}
+	unsigned stolen=0;
+	for(unsigned j=1; j<playing; ++j){
+		if(stealing==OLDEST){
+			if(voices[j].age>voices[stolen].age) stolen=j;
+		}
+		else if(loudness(voices[j])<loudness(voices[stolen])) stolen=j;
+	}
+	voices[stolen]=note;
+}
+
+//how loud a voice is now, or will get if it hasn't started
+float Sonic::loudness(const Note& note) const{
+	if(note.age<0) return note.volume;
+	float result=0.0f;
+	for(unsigned k=0; k<OSCILLATORS; ++k)
+		if(oscillators[k].output)
+			result+=note.runners[k].amplitude*oscillators[k].amplitude;
+	return result*note.volume;
 }
 
 float Sonic::wave(float phase){
@@ -700,7 +1007,7 @@ void Sonic::Delegate::note(float frequency, unsigned duration, float volume, uns
 	note.duration=duration;
 	for(unsigned i=0; i<OSCILLATORS; ++i)
 		note.runners[i].step=frequency/sampleRate*oscillators[i].frequencyMultiplier;
-	notes->push_back(note);
+	sonic->play(note);
 }
 
 /*=====RisingTone=====*/
@@ -708,27 +1015,43 @@ RisingTone::~RisingTone(){ delete[] samples; }
 
 void* RisingTone::perform(std::string action, void* data){
 	if(action=="samples") return samples;
-	else if(action=="play"){
-		freq=((float*)data)[0];
-		maxVolume=((float*)data)[1];
-		volume=0.0f;
-		age=0;
-		return NULL;
-	}
 	return NULL;
 }
 
+unsigned RisingTone::parameter(const string& name) const{
+	if(name=="frequency") return FREQUENCY;
+	else if(name=="play") return PLAY;
+	return NO_PARAMETER;
+}
+
+void RisingTone::set(unsigned parameter, float value, unsigned offset){
+	if(parameter==FREQUENCY) startFreq=value;
+	else if(parameter==PLAY){
+		startVolume=value;
+		start=offset;
+	}
+}
+
 void RisingTone::initialize(unsigned _sampleRate, unsigned samplesAtOnce){
 	sampleRate=_sampleRate;
 	samples=new float[samplesAtOnce];
 	size=samplesAtOnce;
 	phase=0.0f;
+	freq=startFreq=0.0f;
 	volume=0;
+	maxVolume=0.0f;
 	age=sampleRate*2;
 }
 
 void RisingTone::evaluate(){
 	for(unsigned i=0; i<size; ++i){
+		if(i==start){
+			freq=startFreq;
+			maxVolume=startVolume;
+			volume=0.0f;
+			age=0;
+			start=NONE;
+		}
 		if(age<(int)sampleRate/10) volume+=maxVolume*10.0f/sampleRate;
 		else if(volume<=0) volume=0.0f;
 		else volume-=maxVolume*3.0f/sampleRate;
@@ -772,10 +1095,14 @@ Adder::~Adder(){ delete samples; }
 
 void* Adder::perform(std::string action, void* data){
 	if(action=="samples") return samples;
-	else if(action=="volume") volume=*(float*)data;
 	return NULL;
 }
 
+unsigned Adder::parameter(const string& name) const{
+	if(name=="volume") return VOLUME;
+	return NO_PARAMETER;
+}
+
 void Adder::initialize(unsigned sampleRate, unsigned samplesAtOnce){
 	samples=new float[samplesAtOnce];
 	for(unsigned i=0; i<samplesAtOnce; ++i) samples[i]=0.0f;
@@ -786,13 +1113,16 @@ void Adder::addInput(Component& input){
 	inputs.push_back((float*)input.perform("samples", NULL));
 }
 
+void Adder::set(unsigned parameter, float value, unsigned offset){
+	nextVolume=value;
+	volumeChange=offset;
+}
+
 void Adder::evaluate(){
-	for(unsigned i=0; i<size; ++i) samples[i]=0;
-	for(unsigned i=0; i<inputs.size(); ++i)
-		for(unsigned j=0; j<size; ++j)
-			samples[j]+=inputs[i][j]*volume;
-	for(unsigned i=0; i<size; ++i){
-		if(samples[i]<-1.0f) samples[i]=-1.0f;
-		else if(samples[i]>1.0f) samples[i]=1.0f;
-	}
+	unsigned change=volumeChange<size?volumeChange:size;
+	const float* const* sources=inputs.empty()?NULL:&inputs[0];
+	mix(sources, inputs.size(), volume, samples, 0, change);
+	mix(sources, inputs.size(), nextVolume, samples, change, size);
+	if(change<size) volume=nextVolume;
+	volumeChange=NONE;
 }
@@ -77,36 +77,160 @@ class Midi{
 };
 
 /*=====Skeleton=====*/
+//A fixed size queue that one thread pushes to while another pops from it, neither ever waiting
+//on the other. Each index is only written by one side, and the barriers make the slot writes
+//visible before the index that hands them over.
+template<typename T> class SpscQueue{
+	public:
+		SpscQueue(unsigned capacity): slots(capacity+1), head(0), tail(0) {}
+		//false if it's full
+		bool push(const T& item){
+			unsigned next=(tail+1)%slots.size();
+			if(next==head) return false;
+			slots[tail]=item;
+			__sync_synchronize();
+			tail=next;
+			return true;
+		}
+		//false if it's empty
+		bool pop(T& item){
+			if(head==tail) return false;
+			__sync_synchronize();
+			item=slots[head];
+			__sync_synchronize();
+			head=(head+1)%slots.size();
+			return true;
+		}
+	private:
+		std::vector<T> slots;
+		volatile unsigned head, tail;
+};
+
 class System;
 
 class Component{
 	friend class System;
 	public:
+		static const unsigned NO_PARAMETER=~0u;
 		virtual ~Component(){}
 		Component& operator>>(Component& other);
+		//for wiring components together, parameters are set through System::set
 		virtual void* perform(std::string action, void* data){ return NULL; }
+		//the handle of the parameter with this name, or NO_PARAMETER
+		virtual unsigned parameter(const std::string& name) const{ return NO_PARAMETER; }
 	private:
 		virtual void initialize(unsigned sampleRate, unsigned samplesAtOnce){}
 		virtual void addInput(Component& input){}
 		virtual void addOutput(Component& output){}
 		virtual void evaluate()=0;
+		//the parameter takes the value offset samples into the next evaluate
+		virtual void set(unsigned parameter, float value, unsigned offset){}
+		std::vector<Component*> sources;//connected to this with >>
 };
 
+//Components are evaluated after everything connected to them with >>, in levels that each only
+//depend on the ones before. build works out the levels, once everything is added and connected
+//and before the first evaluate. A cycle is broken at whichever of its components was added
+//first, which then reads its sources' last block, not at what only depends on the cycle.
+//Levels of at least MIN_SHARED components are shared with the workers given to setWorkers.
+//The evaluating thread claims whatever they haven't, so it never waits for one to wake up,
+//only for components a worker is already in the middle of.
 class System{
 	public:
+		typedef double (*Clock)();//seconds since whenever
+		typedef void (*Wake)(void* data, unsigned workers);//must not block
 		System(unsigned sampleRate, unsigned samplesAtOnce);
 		~System();
 		void addComponent(std::string name, Component*);
 		Component& component(std::string name);
 		void attachToOutput(Component&);
+		//A component's parameter, looked up by name while the graph is built, so that setting
+		//it afterward doesn't involve any names. Empty if there's no such parameter.
+		struct Port{
+			Port(): component(NULL), parameter(Component::NO_PARAMETER) {}
+			Component* component;
+			unsigned parameter;
+		};
+		Port port(const std::string& component, const std::string& parameter);
+		//Safe to call from one thread other than the one evaluating, and never waits.
+		//The parameter is set delay samples after the start of the next evaluate.
+		//Returns false, dropping the value, if the port is empty or too many are waiting.
+		bool set(const Port&, float value, unsigned delay=0);
+		//returns how many cycles it had to break
+		unsigned build();
 		const float* evaluate();
+		//Helps evaluate the level being shared, if there is one, and returns whether there was
+		//anything to do. Meant for a worker to call until it's false each time it's woken.
+		//Never waits.
+		bool work();
+		//wake is called by the evaluating thread when a level is shared, with how many workers
+		//it could use. Not to be changed while evaluating.
+		void setWorkers(unsigned workers, Wake wake, void* data);
+		//Evaluates taking longer than seconds by the clock are counted as overruns. They're only
+		//measured, an evaluate isn't cut short. Once waiting on workers has taken an evaluate
+		//past the budget, it stops sharing levels with them, and that's counted too.
+		void setBudget(double seconds, Clock clock);
+		unsigned readOverruns() const{ return overruns; }
+		unsigned readLateWorkers() const{ return lateWorkers; }
+		double readWorstEvaluate() const{ return worstEvaluate; }
 	private:
+		static const unsigned MAX_SETTINGS=256;
+		//Components in a level worth waking workers for. A Noter takes about 12 us a block and
+		//waking a worker costs the evaluating thread about 1.5 us, so from 4 a worker has most
+		//of 3 components' time to wake up in and still take one. The game's 5 Noters are shared.
+		static const unsigned MIN_SHARED=4;
+		static const unsigned MAX_SHARED=0xffff;//levels ending past this aren't, see claims
+		static const unsigned MAX_SPINS=64;//waiting on workers spins this long before yielding
+		struct Setting{
+			Port port;
+			float value;
+			unsigned delay;
+		};
 		std::vector<Component*> components;
 		std::map<std::string, Component*> componentsByName;
 		unsigned sampleRate, samplesAtOnce;
 		float* samples;
+		SpscQueue<Setting> settings;
+		std::vector<Setting> delayed;//taken from the queue, but not due in this evaluate
+		bool claim(unsigned& i);
+		std::vector<Component*> ordered;//a level at a time
+		std::vector<unsigned> levelEnds;
+		//The end of the shared level in the high 16 bits, and the next of its components to
+		//claim in the low. They're one word so that a claim can only succeed while its level
+		//is open. Once everything's claimed, they're equal until the next shared level.
+		volatile unsigned claims;
+		volatile unsigned done;//components of the shared level evaluated
+		unsigned workers;
+		Wake wake;
+		void* wakeData;
+		double budget, worstEvaluate;
+		Clock clock;
+		unsigned overruns, lateWorkers;
+};
+
+/*=====Kernels=====*/
+//Loops over blocks of samples, 4 at a time with SSE2 if the compiler has it, otherwise one at a
+//time with the same results.
+
+//Mixes the sources from begin to end, scaled by volume and clipped to -1 to 1, into destination.
+//Each sample is summed in one go, so destination is only written once.
+void mix(
+	const float* const* sources, unsigned count, float volume,
+	float* destination, unsigned begin, unsigned end
+);
+
+//Noise to hide quantization with, four interleaved xorshift streams.
+struct Dither{
+	Dither();
+	unsigned state[4];
 };
 
+//Clips samples to -1 to 1, scales them, and rounds them toward zero into destination,
+//first adding triangular noise of up to a step either way if dither isn't NULL.
+void toInt16(
+	const float* samples, unsigned size, float scale, short* destination, Dither* dither=NULL
+);
+
 /*=====Controllers=====*/
 class Notes: public Component{
 	public:
@@ -130,13 +254,17 @@ class Notes: public Component{
 };
 
 /*=====Sources=====*/
+//its volume is only updated once per evaluate, so offsets are ignored
 class LFSRNoise: public Component{
 	public:
 		LFSRNoise(int decayLength);
 		~LFSRNoise();
 		void* perform(std::string action, void* data);
+		unsigned parameter(const std::string& name) const;
 	private:
+		enum Parameter{ INITIAL_VOLUME, VOLUME };
 		void initialize(unsigned sampleRate, unsigned samplesAtOnce);
+		void set(unsigned parameter, float value, unsigned offset);
 		void evaluate();
 		float* samples;
 		unsigned size, state;
@@ -146,31 +274,64 @@ class LFSRNoise: public Component{
 
 float triangle(float phase);
 
+//plays one of its sets of notes when play is set, at that volume
 class Noter: public Component{
 	public:
 		Noter(std::vector<std::vector<std::pair<float, int> > > notes):
-			notes(notes), volume(0.0f), desiredVolume(0.0f), phase(0.0f), note(0), noteSet(0)
+			notes(notes), t(0), phase(0.0f), note(0), done(true), volume(0.0f), desiredVolume(0.0f),
+			noteSet(0), startCount(0), randomState(0x9e3779b9)
 		{}
 		~Noter(){ delete samples; }
 
 		void* perform(std::string action, void* data){
 			if(action=="samples") return samples;
-			t=0;
-			note=0;
-			done=false;
-			desiredVolume=*(float*)data;
-			noteSet=std::rand()%notes.size();
 			return NULL;
 		}
 
+		unsigned parameter(const std::string& name) const{
+			if(name=="play") return PLAY;
+			return NO_PARAMETER;
+		}
+
 	private:
+		enum Parameter{ PLAY };
+		static const unsigned MAX_STARTS=8;//plays kept per evaluate, more are dropped
+		struct Start{
+			unsigned offset;
+			float volume;
+			int noteSet;
+		};
+
 		void initialize(unsigned sampleRate, unsigned samplesAtOnce){
 			samples=new float[samplesAtOnce];
 			size=samplesAtOnce;
 		}
 
+		//Plays are kept in order of offset, so each one in an evaluate restarts the notes.
+		//The note set is picked here with the Noter's own xorshift, since rand's state is shared
+		//with the game's thread.
+		void set(unsigned parameter, float value, unsigned offset){
+			if(startCount==MAX_STARTS) return;
+			randomState^=randomState<<13;
+			randomState^=randomState>>17;
+			randomState^=randomState<<5;
+			unsigned i=startCount++;
+			for(; i>0&&starts[i-1].offset>offset; --i) starts[i]=starts[i-1];
+			starts[i].offset=offset;
+			starts[i].volume=value;
+			starts[i].noteSet=randomState%notes.size();
+		}
+
 		void evaluate(){
+			unsigned nextStart=0;
 			for(unsigned i=0; i<size; ++i){
+				for(; nextStart<startCount&&starts[nextStart].offset==i; ++nextStart){
+					t=0;
+					note=0;
+					done=false;
+					desiredVolume=starts[nextStart].volume;
+					noteSet=starts[nextStart].noteSet;
+				}
 				if(done) desiredVolume=0.0f;
 				samples[i]=volume*triangle(phase);
 				phase+=notes[noteSet][note].first;
@@ -183,6 +344,7 @@ class Noter: public Component{
 				}
 				volume=(8*volume+desiredVolume)/9;
 			}
+			startCount=0;
 		}
 
 		float* samples;
@@ -195,13 +357,21 @@ class Noter: public Component{
 		float volume;
 		float desiredVolume;
 		int noteSet;
+		Start starts[MAX_STARTS];//for the next evaluate, by offset
+		unsigned startCount;
+		unsigned randomState;
 };
 
+//Its volume is only updated once per evaluate, so offsets are ignored. Notes are played by a
+//fixed number of voices, all allocated up front, and once they're all playing a new note takes
+//over the oldest or the quietest one.
 class Sonic: public Component{
 	public:
-		Sonic(float volume);
+		enum Stealing{ OLDEST, QUIETEST };
+		Sonic(float volume, unsigned polyphony=POLYPHONY, Stealing stealing=OLDEST);
 		~Sonic();
 		void* perform(std::string action, void* data);
+		unsigned parameter(const std::string& name) const;
 		void setOscillator(
 			unsigned oscillator, float frequencyMultiplier, float amplitude,
 			float attack, float decay, float sustain, float release
@@ -209,8 +379,11 @@ class Sonic: public Component{
 		void connectOscillators(unsigned from, unsigned to, float amount);
 		void connectToOutput(unsigned oscillator);
 	private:
+		enum Parameter{ VOLUME };
 		static const unsigned OSCILLATORS=4;
+		static const unsigned POLYPHONY=16;//voices by default
 		void initialize(unsigned sampleRate, unsigned samplesAtOnce);
+		void set(unsigned parameter, float value, unsigned offset);
 		void evaluate();
 		float wave(float phase);
 		float* samples;
@@ -230,33 +403,47 @@ class Sonic: public Component{
 			float phase, step, amplitude, output;
 		};
 		struct Note{
+			Note(): done(false) {}
 			Runner runners[OSCILLATORS];
 			float volume;
 			int age, duration;
+			bool done;
 		};
-		std::vector<Note> notes;
+		void play(const Note&);
+		float loudness(const Note&) const;
+		std::vector<Note> voices;//the first playing of them are in use
+		unsigned playing;
+		Stealing stealing;
 		class Delegate: public Notes::Delegate{
 			public:
 				void note(
 					float frequency, unsigned duration, float volume, unsigned wait
 				);
 				Oscillator* oscillators;
-				std::vector<Note>* notes;
+				Sonic* sonic;
 				unsigned sampleRate;
 		} notesDelegate;
 };
 
+//setting play starts it rising from the frequency last set, at that volume
 class RisingTone: public Component{
 	public:
+		RisingTone(): start(NONE) {}
 		~RisingTone();
 		void* perform(std::string action, void* data);
+		unsigned parameter(const std::string& name) const;
 	private:
+		enum Parameter{ FREQUENCY, PLAY };
+		static const unsigned NONE=~0u;
 		void initialize(unsigned sampleRate, unsigned samplesAtOnce);
+		void set(unsigned parameter, float value, unsigned offset);
 		void evaluate();
 		float* samples;
 		unsigned size, sampleRate;
 		float phase, freq, volume, maxVolume;
 		int age;
+		unsigned start;//sample of this evaluate to start at, or NONE
+		float startFreq, startVolume;
 };
 
 class MidiOut: public Component{
@@ -280,17 +467,23 @@ class FastLowPass: public Component{
 
 class Adder: public Component{
 	public:
-		Adder(): volume(1.0f) {}
+		Adder(): volume(1.0f), volumeChange(NONE) {}
 		~Adder();
 		void* perform(std::string action, void* data);
+		unsigned parameter(const std::string& name) const;
 	private:
+		enum Parameter{ VOLUME };
+		static const unsigned NONE=~0u;
 		void initialize(unsigned sampleRate, unsigned samplesAtOnce);
 		void addInput(Component& input);
+		void set(unsigned parameter, float value, unsigned offset);
 		void evaluate();
 		std::vector<float*> inputs;
 		float* samples;
 		unsigned size;
 		float volume;
+		unsigned volumeChange;//sample of this evaluate the volume changes at, or NONE
+		float nextVolume;
 };
 
 }//namespace dal
@@ -3,119 +3,10 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
-#include <ctime>
-#include <set>
 
 using namespace std;
 using namespace dal;
 
-//=====helpers=====//
-bool intersects(
-	float xi1, float yi1, float dx1, float dy1,
-	float xi2, float yi2, float dx2, float dy2,
-	float tAllowance, float sAllowance
-){
-	if(dx2*dy1-dy2*dx1==0) return false;
-	if(dx2!=0){
-		float t=(yi2+dy2*(xi1-xi2)/dx2-yi1)*dx2/(dx2*dy1-dy2*dx1);
-		if(t<tAllowance||t>1-tAllowance) return false;
-		float s=(xi1+dx1*t-xi2)/dx2;
-		if(s<sAllowance||s>1-sAllowance) return false;
-	}
-	else{
-		float t=-(xi2+dx2*(yi1-yi2)/dy2-xi1)*dy2/(dx2*dy1-dy2*dx1);
-		if(t<tAllowance||t>1-tAllowance) return false;
-		float s=(yi1+dy1*t-yi2)/dy2;
-		if(s<sAllowance||s>1-sAllowance) return false;
-	}
-	return true;
-}
-
-float linear(float a, float b, float bness){
-	return a*(1-bness)+b*bness;
-}
-
-int clamp(int i, int lo, int hi){
-	if(i<lo) return lo;
-	if(i>hi) return hi;
-	return i;
-}
-
-void getInitialTerminalCaves(
-	unsigned cave,
-	const vector<Cave>& caves,
-	set<unsigned>& initialTerminalCaves,
-	set<unsigned> alreadyVisited=set<unsigned>(),
-	int platformlessCavesPassed=0
-){
-	//only visit a cave once
-	if(alreadyVisited.find(cave)!=alreadyVisited.end()) return;
-	alreadyVisited.insert(cave);
-	//handle platformless cave
-	if(!caves[cave].platforms) ++platformlessCavesPassed;
-	//next caves
-	for(int i=-1; i<int(caves[cave].children.size()); ++i){
-		unsigned nextCave;
-		if(i==-1) nextCave=caves[cave].parent;
-		else nextCave=caves[cave].children[i];
-		//don't go to unreachable caves
-		if(!caves[cave].platforms){
-			//if the next cave is not at the bottom
-			if(i!=-1&&caves[nextCave].connectionY-2>min(caves[cave].yi, caves[cave].yf))
-				//don't process it
-				continue;
-		}
-		//handle passing a platformless cave
-		if(platformlessCavesPassed!=0){
-			if(!caves[cave].children.size())
-				initialTerminalCaves.insert(cave);
-		}
-		//recurse
-		getInitialTerminalCaves(
-			nextCave, caves, initialTerminalCaves, alreadyVisited,
-			platformlessCavesPassed
-		);
-	}
-}
-
-void getCavesPastHiJumps(
-	unsigned cave,
-	const vector<Cave>& caves,
-	set<unsigned>& cavesPastHiJumps,
-	set<unsigned> alreadyVisited=set<unsigned>(),
-	bool hiJumpCavePassed=false
-){
-	//only visit a cave once
-	if(alreadyVisited.find(cave)!=alreadyVisited.end()) return;
-	alreadyVisited.insert(cave);
-	//if past a hi jump, put this cave in the result
-	if(hiJumpCavePassed)
-		cavesPastHiJumps.insert(cave);
-	//next caves
-	for(int i=-1; i<int(caves[cave].children.size()); ++i){
-		unsigned nextCave;
-		if(i==-1) nextCave=caves[cave].parent;
-		else nextCave=caves[cave].children[i];
-		//hi jump passages
-		if(!caves[cave].platforms){
-			//if the next cave is not at the bottom
-			if(i!=-1&&caves[nextCave].connectionY-12>min(caves[cave].yi, caves[cave].yf)){
-				//go to it, but mark it accordingly
-				getCavesPastHiJumps(
-					nextCave, caves, cavesPastHiJumps, alreadyVisited,
-					true
-				);
-				continue;
-			}
-		}
-		//recurse
-		getCavesPastHiJumps(
-			nextCave, caves, cavesPastHiJumps, alreadyVisited,
-			hiJumpCavePassed
-		);
-	}
-}
-
 void pushTile(float x, float y, float w, float h, float r, float g, float b, vector<Vertex>& vertices){
 	vertices.push_back(Vertex(x  , y  , r, g, b));
 	vertices.push_back(Vertex(x+w, y  , r, g, b));
@@ -147,426 +38,297 @@ void Object::update(){
 	++framesSinceGrounded;
 }
 
-//=====struct Cave=====//
-void Cave::hole(
-	unsigned x, unsigned y, float size,
-	int platformStep, int platformSize, int platformSpace,
-	int platformXOffset, int platformYOffset,
-	bool platforms,
-	Tiles& tiles
-){
-	x+=size/4*(1.0f*rand()/RAND_MAX-0.5f);
-	y+=size/4*(1.0f*rand()/RAND_MAX-0.5f);
-	if(platforms){
-		for(int i=max(x-size, 0.0f); i<=min(x+size, tiles.readW()-1.0f); ++i)
-			for(int j=max(y-size, 0.0f); j<=min(y+size, tiles.readH()-1.0f); ++j)
-				if((i-x)*(i-x)+(j-y)*(j-y)<size*size){
-					bool isPlatform=false;
-					int platformI=i+platformXOffset*j/platformStep;
-					if((j+platformI/platformSpace*platformYOffset)%platformStep==0)
-						if(platformI%platformSpace<platformSize)
-							isPlatform=true;
-					if(isPlatform){
-						if(tiles.at(i, j)!=STAY_EMPTY)
-							tiles.set(i, j, WALL);
-					}
-					else tiles.set(i, j, EMPTY);
-				}
-	}
-	else
-		for(int i=max(x-size, 0.0f); i<=min(x+size, tiles.readW()-1.0f); ++i)
-			for(int j=max(y-size, 0.0f); j<=min(y+size, tiles.readH()-1.0f); ++j)
-				tiles.set(i, j, STAY_EMPTY);
+//=====struct Bodies=====//
+unsigned Bodies::add(float _x, float _y, unsigned char _controls){
+	x.push_back(_x);
+	y.push_back(_y);
+	px.push_back(_x);
+	py.push_back(_y);
+	vx.push_back(0.0f);
+	vy.push_back(0.0f);
+	impulseX.push_back(0.0f);
+	impulseY.push_back(0.0f);
+	framesSinceGrounded.push_back(1);
+	hiJumps.push_back(0);
+	splashed.push_back(0);
+	controls.push_back(_controls);
+	events.push_back(0);
+	bumped.push_back(true);
+	return x.size()-1;
 }
-	
-void Cave::implement(Tiles& tiles){
-	unsigned d=max(abs(int(xf)-int(xi)), abs(int(yf)-int(yi)));
-	const int platformStep=3+rand()%2;
-	const int platformSize=2+rand()%2;
-	const int platformSpace=platformSize+1+rand()%6;
-	const int platformXOffset=1+rand()%(platformSpace-1);
-	const int platformYOffset=rand()%platformStep;
-	if(d==0){
-		hole(
-			xi, yi, size*(1+1.0f*rand()/RAND_MAX),
-			platformStep, platformSize, platformSpace,
-			platformXOffset, platformYOffset,
-			platforms,
-			tiles
-		);
+
+class BodiesJob: public Job{
+	public:
+		BodiesJob(Bodies& bodies, const Tiles& tiles, unsigned begin, unsigned end):
+			bodies(bodies), tiles(tiles), begin(begin), end(end)
+		{}
+		void run(){ bodies.stepBatch(tiles, begin, end); }
+	private:
+		Bodies& bodies;
+		const Tiles& tiles;
+		unsigned begin, end;
+};
+
+void Bodies::step(const Tiles& tiles, unsigned begin, unsigned end, ThreadPool* pool){
+	//streamed regions are loaded when they're touched, which only one thread can do
+	if(!pool||pool->readThreads()==1||tiles.isStreamed()||end-begin<2*MIN_BATCH){
+		stepBatch(tiles, begin, end);
 		return;
 	}
-	for(unsigned i=0; i<=d; ++i)
-		hole(
-			linear(xi, xf, 1.0f*i/d), linear(yi, yf, 1.0f*i/d), size,
-			platformStep, platformSize, platformSpace,
-			platformXOffset, platformYOffset,
-			platforms,
-			tiles
-		);
+	unsigned batch=max((end-begin)/pool->readThreads(), unsigned(MIN_BATCH));
+	vector<Job*> jobs;
+	for(unsigned i=begin; i<end; i+=batch)
+		jobs.push_back(new BodiesJob(*this, tiles, i, min(i+batch, end)));
+	pool->run(jobs);
+	for(unsigned i=0; i<jobs.size(); ++i) delete jobs[i];
 }
 
-bool Cave::addBranch(unsigned& x, unsigned& y){
-	if(branches.size()>=3) return false;
-	while(true){
-		float t=1.0f*rand()/RAND_MAX;
-		bool good=true;
-		for(unsigned i=0; i<branches.size(); ++i)
-			if(abs(t-branches[i])<0.2f){
-				good=false;
-				break;
-			}
-		if(!good) continue;
-		branches.push_back(t);
-		x=linear(xi, xf, t);
-		y=linear(yi, yf, t);
-		break;
+void Bodies::stepBatch(const Tiles& tiles, unsigned begin, unsigned end){
+	//jumping depends on the tile below, so it's done body by body
+	for(unsigned i=begin; i<end; ++i){
+		events[i]=0;
+		if(!(controls[i]&JUMPING)) continue;
+		bool grounded=tiles.at(x[i]/TILE_SIZE, y[i]/TILE_SIZE-1)==WALL&&vy[i]<=0;
+		if(hiJumps[i]||grounded){
+			if(grounded) vy[i]=20*TILE_SIZE;
+			else vy[i]=8*hiJumps[i]*TILE_SIZE;
+			events[i]|=JUMPED;
+		}
+	}
+	//the rest of the velocity and position updates are the same for every body
+	const float groundMovement=TILE_SIZE*2;
+	const float airMovement=TILE_SIZE/2;
+	const float airFriction=1.01f;
+	const float speedLimit=TILE_SIZE*FPS;
+	for(unsigned i=begin; i<end; ++i){
+		bool grounded=framesSinceGrounded[i]==0;
+		float movement=grounded?groundMovement:airMovement;
+		float friction=grounded?1.0f:airFriction;
+		vx[i]+=controls[i]&RIGHT?movement:controls[i]&LEFT?-movement:0.0f;
+		vx[i]=min(max(vx[i]/friction, -speedLimit), speedLimit);
+		vy[i]=min(max((vy[i]-1.0f*GRAVITY/FPS)/friction, -speedLimit), speedLimit);
 	}
-	return true;
+	for(unsigned i=begin; i<end; ++i){
+		px[i]=x[i];
+		py[i]=y[i];
+		x[i]+=impulseX[i]?impulseX[i]:vx[i]/FPS;
+		y[i]+=impulseY[i]?impulseY[i]:vy[i]/FPS;
+		impulseX[i]=0.0f;
+		impulseY[i]=0.0f;
+		++framesSinceGrounded[i];
+	}
+	for(unsigned i=begin; i<end; ++i) collide(tiles, i);
 }
 
-//=====class Game=====//
-int Game::mondrianize(int x, int y, int dx, int dy, float size, bool lo){
-	int n=0;
-	while(x>=0&&y>=0&&x<tiles.readW()&&y<tiles.readH()){
-		bool willBreak=false;
-		if(dx>0&&tiles.mondrianLAt(x, y)!=0.0f) break;
-		if(dy>0&&tiles.mondrianDAt(x, y)!=0.0f) break;
-		if(dx<0&&tiles.mondrianRAt(x, y)!=0.0f) break;
-		if(dy<0&&tiles.mondrianUAt(x, y)!=0.0f) break;
-		if(
-			tiles.mondrianLAt(x, y)!=0.0f||
-			tiles.mondrianRAt(x, y)!=0.0f||
-			tiles.mondrianUAt(x, y)!=0.0f||
-			tiles.mondrianDAt(x, y)!=0.0f
-		)
-			willBreak=true;
-		if(size>=0){
-			if(dx!=0){
-				if(lo)
-					tiles.mondrianDAt(x, y)=size;
-				else
-					tiles.mondrianUAt(x, y)=size;
+//less overlap than this, in tiles, is only touching, so rounding doesn't snag on walls
+const float TOUCHING=1e-4f;
+
+//The columns or rows a body at a tiles along an axis overlaps, lo to hi. Moving by d, the one
+//its leading edge last entered is next-step, and counts even while it's only just in it.
+static void getSpan(float a, float d, int next, int& lo, int& hi){
+	lo=int(floor(a+TOUCHING));
+	hi=int(ceil(a+1-TOUCHING))-1;
+	if(d>0) hi=next-1;
+	else if(d<0) lo=next+1;
+}
+
+//whether column tileX has a wall in a row the body overlaps, at y tiles up moving by dy
+static bool wallInColumn(const Tiles& tiles, int tileX, float y, float dy, int nextY){
+	int lo, hi;
+	getSpan(y, dy, nextY, lo, hi);
+	for(int tileY=lo; tileY<=hi; ++tileY)
+		if(tiles.at(tileX, tileY)==WALL) return true;
+	return false;
+}
+
+//whether row tileY has a wall in a column the body overlaps, at x tiles across moving by dx
+static bool wallInRow(const Tiles& tiles, int tileY, float x, float dx, int nextX){
+	int lo, hi;
+	getSpan(x, dx, nextX, lo, hi);
+	for(int tileX=lo; tileX<=hi; ++tileX)
+		if(tiles.at(tileX, tileY)==WALL) return true;
+	return false;
+}
+
+//Sweeps body i's square from px, py to x, y, walking the columns and rows its leading edges
+//enter in the order they reach them. At the first wall on an axis, it stops flush against it
+//and slides on along the other. A move across n tiles looks at no more than 3*(n+2) tiles,
+//so nothing can pass through a wall however fast it goes, and the cost of a move is bounded.
+void Bodies::collide(const Tiles& tiles, unsigned i){
+	const float collisionFriction=1.5f;
+	//in tiles, the move left to check is of the bottom left corner, from a by d
+	float ax=px[i]/TILE_SIZE, ay=py[i]/TILE_SIZE;
+	float dx=x[i]/TILE_SIZE-ax, dy=y[i]/TILE_SIZE-ay;
+	bool hit=false;
+	bool moving=true;
+	while(moving){
+		int stepX=dx>0?1:-1, stepY=dy>0?1:-1;
+		//the next column and row the leading edges enter,
+		//and how far along the move they're entered, past 1 if they aren't
+		int nextX=dx>0?int(ceil(ax+1-TOUCHING)):int(floor(ax+TOUCHING))-1;
+		int nextY=dy>0?int(ceil(ay+1-TOUCHING)):int(floor(ay+TOUCHING))-1;
+		float tX=dx?max((dx>0?nextX-ax-1:ax-nextX-1)/fabs(dx), 0.0f):2.0f;
+		float tY=dy?max((dy>0?nextY-ay-1:ay-nextY-1)/fabs(dy), 0.0f):2.0f;
+		moving=false;
+		while(tX<=1.0f||tY<=1.0f){
+			bool hitX=false;
+			if(tX==tY){
+				//through a corner, a wall above or below wins, as does one diagonally across
+				hitX=wallInColumn(tiles, nextX, ay+dy*tX, dy, nextY);
+				bool hitY=
+					wallInRow(tiles, nextY, ax+dx*tY, dx, nextX)
+					||
+					(!hitX&&tiles.at(nextX, nextY)==WALL)
+				;
+				if(!hitX&&!hitY){
+					nextX+=stepX;
+					nextY+=stepY;
+					tX+=1/fabs(dx);
+					tY+=1/fabs(dy);
+					continue;
+				}
+				if(hitY) hitX=false;
+			}
+			else if(tX<tY){
+				if(!wallInColumn(tiles, nextX, ay+dy*tX, dy, nextY)){
+					nextX+=stepX;
+					tX+=1/fabs(dx);
+					continue;
+				}
+				hitX=true;
+			}
+			else if(!wallInRow(tiles, nextY, ax+dx*tY, dx, nextX)){
+				nextY+=stepY;
+				tY+=1/fabs(dy);
+				continue;
+			}
+			//stop against the wall, and carry on with what's left of the other axis
+			if(hitX){
+				x[i]=(nextX-stepX)*TILE_SIZE;
+				vx[i]=0.0f;
+				vy[i]/=collisionFriction;
+				ax=x[i]/TILE_SIZE;
+				ay+=dy*tX;
+				dx=0.0f;
+				dy*=1-tX;
 			}
-			else{//dy!=0
-				if(lo)
-					tiles.mondrianLAt(x, y)=size;
-				else
-					tiles.mondrianRAt(x, y)=size;
+			else{
+				y[i]=(nextY-stepY)*TILE_SIZE;
+				vx[i]/=collisionFriction;
+				vy[i]=0.0f;
+				ax+=dx*tY;
+				ay=y[i]/TILE_SIZE;
+				dx*=1-tY;
+				dy=0.0f;
 			}
+			framesSinceGrounded[i]=0;
+			hit=true;
+			moving=dx||dy;
+			break;
 		}
-		if(willBreak) break;
-		x+=dx;
-		y+=dy;
-		++n;
 	}
-	return n;
+	int tileX=int(floor(x[i]/TILE_SIZE));
+	int tileY=int(floor(y[i]/TILE_SIZE));
+	if(hit&&!bumped[i]) events[i]|=BUMPED;
+	bumped[i]=hit;
+	if(splashed[i]>0) --splashed[i];
+	if(controls[i]&SPLASHES&&!splashed[i]&&tiles.at(tileX, tileY)==WATER){
+		events[i]|=SPLASHED;
+		splashed[i]=30;
+	}
+	if(!(controls[i]&SCUBA)&&tiles.at(tileX, tileY)==WATER){
+		const float waterFriction=2.0f;
+		vx[i]/=waterFriction;
+		vy[i]/=waterFriction;
+	}
 }
 
-Game::Game(dal::System* system):
+//=====class Pickups=====//
+void Pickups::add(float x, float y, Kind kind){
+	xs.push_back(x);
+	ys.push_back(y);
+	kinds.push_back(kind);
+	if(xs.size()>buckets.size()){
+		buckets.assign(buckets.size()*2, vector<unsigned>());
+		for(unsigned i=0; i<xs.size(); ++i) bucket(cell(xs[i]), cell(ys[i])).push_back(i);
+	}
+	else bucket(cell(x), cell(y)).push_back(xs.size()-1);
+}
+
+bool Pickups::take(float x, float y, Kind& kind){
+	//anything touching is in the tile at x, y or one next to it
+	int cellX=cell(x), cellY=cell(y);
+	for(int i=cellX-1; i<=cellX+1; ++i)
+		for(int j=cellY-1; j<=cellY+1; ++j){
+			const vector<unsigned>& candidates=bucket(i, j);
+			for(unsigned k=0; k<candidates.size(); ++k){
+				unsigned pickup=candidates[k];
+				if(abs(xs[pickup]-x)<TILE_SIZE&&abs(ys[pickup]-y)<TILE_SIZE){
+					kind=kinds[pickup];
+					remove(pickup);
+					return true;
+				}
+			}
+		}
+	return false;
+}
+
+int Pickups::cell(float coordinate){ return int(floor(coordinate/TILE_SIZE)); }
+
+vector<unsigned>& Pickups::bucket(int cellX, int cellY){
+	unsigned hash=unsigned(cellX)*73856093u^unsigned(cellY)*19349663u;
+	return buckets[hash&(buckets.size()-1)];
+}
+
+void Pickups::remove(unsigned i){
+	vector<unsigned>& removed=bucket(cell(xs[i]), cell(ys[i]));
+	*find(removed.begin(), removed.end(), i)=removed.back();
+	removed.pop_back();
+	unsigned last=xs.size()-1;
+	if(i!=last){
+		vector<unsigned>& moved=bucket(cell(xs[last]), cell(ys[last]));
+		*find(moved.begin(), moved.end(), last)=i;
+		xs[i]=xs[last];
+		ys[i]=ys[last];
+		kinds[i]=kinds[last];
+	}
+	xs.pop_back();
+	ys.pop_back();
+	kinds.pop_back();
+}
+
+//=====class Game=====//
+Game::Game(dal::System* system, const World& _world, ThreadPool* pool):
+	world(_world),
+	random(_world.seed),
 	playerJumping(false),
 	playerGoingRight(false),
 	playerGoingLeft(false),
-	buddyGoingRight(false),
-	buddyGoingLeft(false),
 	victory(0),
+	system(system),
+	soundDelay(0),
 	playerHiJumpsCollected(0),
-	scubaCollected(false)
+	scubaCollected(false),
+	alpha(1.0f),
+	pool(pool)
 {
 	//sound
-	playerJump=&system->component("playerJump");
-	buddyJump=&system->component("buddyJump");
-	playerBump=&system->component("playerBump");
-	powerup=&system->component("powerup");
-	splash=&system->component("splash");
+	playerJump=system->port("playerJump", "play");
+	buddyJump=system->port("buddyJump", "play");
+	playerBump=system->port("playerBump", "play");
+	powerup=system->port("powerup", "play");
+	splash=system->port("splash", "play");
 	//initialize
-	unsigned seed=unsigned(time(NULL));
-	srand(seed);
-	tiles.resize(256, 256);
-	//MONDRIANIZE ME CAPTAIN
-	for(unsigned i=0; i<tiles.readW(); ++i){
-		float size=0.1f+0.2f*rand()/RAND_MAX;
-		int x=rand()%tiles.readW();
-		int y=rand()%tiles.readH();
-		bool lo=rand()%2;
-		if(
-			tiles.mondrianLAt(x, y)!=0.0f||
-			tiles.mondrianRAt(x, y)!=0.0f||
-			tiles.mondrianUAt(x, y)!=0.0f||
-			tiles.mondrianDAt(x, y)!=0.0f
-		) continue;
-		int w=mondrianize(x, y, 1, 0, -1.0f, lo)+mondrianize(x, y, -1, 0, -1.0f, lo);
-		int h=mondrianize(x, y, 0, 1, -1.0f, lo)+mondrianize(x, y, 0, -1, -1.0f, lo);
-		if(w<h){
-			mondrianize(x, y, 1, 0, size, lo);
-			mondrianize(x-1, y, -1, 0, size, lo);
-		}
-		else{
-			mondrianize(x, y, 0, 1, size, lo);
-			mondrianize(x, y-1, 0, -1, size, lo);
-		}
-	}
-	tiles.mondrianLAt(0, 0)=0.0f;
-	tiles.mondrianRAt(0, 0)=0.0f;
-	tiles.mondrianUAt(0, 0)=0.0f;
-	tiles.mondrianDAt(0, 0)=0.0f;
-	//make some caves
-	const unsigned firstSize=5;
-	const unsigned firstHeight=rand()%(tiles.readH()/2)+tiles.readH()/4+firstSize+1;
-	caves.push_back(Cave(
-		rand()%(tiles.readW()/4)+firstSize+1,
-		firstHeight,
-		rand()%(tiles.readW()/4)+tiles.readW()/2-firstSize-1,
-		firstHeight+rand()%(tiles.readH()/4)-tiles.readH()/8,
-		firstSize,
-		true,
-		0
-	));
-	caves.back().parent=0;
-	vector<unsigned> queue;
-	queue.push_back(0);
-	bool madePlatformlessCave=false;
-	while(queue.size()){
-		//pick a parent
-		unsigned i=rand()%queue.size();
-		//choose whether or not child has platforms
-		bool platforms=rand()%8;
-		if(!madePlatformlessCave) platforms=false;
-		//get location and size
-		unsigned x, y;
-		float size=caves[queue[i]].size/1.25f;
-		if(caves[queue[i]].depth>3||size<2.0f||!caves[queue[i]].addBranch(x, y)){
-			queue.erase(queue.begin()+i);
-			continue;
-		}
-		//get perpendicular direction
-		int dx=int(caves[queue[i]].yi)-int(caves[queue[i]].yf);
-		int dy=int(caves[queue[i]].xf)-int(caves[queue[i]].xi);
-		if(platforms){
-			//maybe flip it
-			if(rand()%2){
-				dx=-dx;
-				dy=-dy;
-			}
-		}
-		else{
-			//force it to be upward
-			if(dy<0) dy=-dy;
-			if(dy>32) dy=32;
-			dx=0;
-		}
-		//change length
-		dx*=0.5f*rand()/RAND_MAX+1.0f;
-		dy*=0.5f*rand()/RAND_MAX+1.0f;
-		//noise
-		if(platforms){
-			float r=sqrt(dx*dx+dy*dy);
-			dx+=r*(0.5f*rand()/RAND_MAX-0.25f);
-			dy+=r*(0.5f*rand()/RAND_MAX-0.25f);
-		}
-		//limit
-		const int extra=4;
-		dx=min(dx, int(tiles.readW()-size-extra-x));
-		dx=max(dx, int(size+extra-x));
-		dy=min(dy, int(tiles.readH()-size-extra-y));
-		dy=max(dy, int(size+extra-y));
-		//check if it overlaps with other caves
-		bool overlaps=false;
-		for(unsigned i=0; i<caves.size(); ++i){
-			int dx2=int(caves[i].xf)-int(caves[i].xi);
-			int dy2=int(caves[i].yf)-int(caves[i].yi);
-			if(intersects(
-				x, y,
-				dx, dy,
-				caves[i].xi, caves[i].yi,
-				dx2, dy2,
-				(caves[i].size+size)/(abs(dx)+abs(dy)),
-				(caves[i].size+size)/(abs(dx2)+abs(dy2))
-			)){
-				overlaps=true;
-				break;
-			}
-		}
-		if(overlaps) continue;
-		//stick it in
-		if(!platforms) madePlatformlessCave=true;
-		caves.push_back(Cave(
-			x,
-			y,
-			clamp(int(x)+dx, 0, tiles.readW()-1),
-			clamp(int(y)+dy, 0, tiles.readH()-1),
-			size,
-			platforms,
-			caves[queue[i]].depth+1
-		));
-		queue.push_back(unsigned(caves.size()-1));
-		//attach
-		caves[queue[i]].children.push_back((unsigned)caves.size()-1);
-		caves.back().parent=queue[i];
-		caves.back().connectionY=y;
-	}
-	for(unsigned i=0; i<caves.size(); ++i) caves[i].implement(tiles);
-	//turn STAY_EMPTY into EMPTY
-	for(unsigned x=0; x<tiles.readW(); ++x)
-		for(unsigned y=0; y<tiles.readH(); ++y)
-			if(tiles.at(x, y)==STAY_EMPTY)
-				tiles.set(x, y, EMPTY);
-	//get rid of diagonals
-	for(unsigned x=0; x<tiles.readW(); ++x)
-		for(unsigned y=0; y<tiles.readH(); ++y)
-			if(
-				tiles.at(x, y)==tiles.at(x+1, y+1)
-				&&
-				tiles.at(x+1, y)==tiles.at(x, y+1)
-				&&
-				tiles.at(x, y)!=tiles.at(x+1, y)
-			){
-				tiles.set(x, y, EMPTY);
-				tiles.set(x+1, y, EMPTY);
-				tiles.set(x, y+1, EMPTY);
-				tiles.set(x+1, y+1, EMPTY);
-			}
-	//add water on the right half
-	bool waterPlaced=false;
-	for(int y=tiles.readH()-1; y>=0; --y)
-		for(int x=tiles.readW()-1; x>tiles.readW()/2; --x){
-			bool goodPlace=false;
-			for(unsigned i=0; i<caves.size(); ++i){
-				int midX=(caves[i].xi+caves[i].xf)/2;
-				int midY=(caves[i].yi+caves[i].yf)/2;
-				if(x==midX&&abs(y-midY)<6) goodPlace=true;
-			}
-			if(!goodPlace) continue;
-			if(
-				tiles.at(x, y)==EMPTY
-				&&
-				tiles.at(x, y+1)==WALL
-			){
-				if(waterPlaced){ if(rand()%2) continue; }
-				else waterPlaced=true;
-				vector<pair<int, int> > waterQueue;
-				waterQueue.push_back(pair<int, int>(x, y));
-				while(waterQueue.size()){
-					int wx=waterQueue.back().first;
-					int wy=waterQueue.back().second;
-					waterQueue.pop_back();
-					tiles.set(wx, wy, WATER);
-					if(tiles.at(wx, wy-1)==EMPTY) waterQueue.push_back(pair<int, int>(wx, wy-1));
-					else{
-						if(tiles.at(wx+1, wy)==EMPTY) waterQueue.push_back(pair<int, int>(wx+1, wy));
-						if(tiles.at(wx-1, wy)==EMPTY) waterQueue.push_back(pair<int, int>(wx-1, wy));
-					}
-				}
-			}
-		}
-	//set the player's position to somewhere on the left
-	int playerX, playerY;
-	int desiredX=tiles.readW(), desiredY;
-	for(unsigned i=0; i<caves.size(); ++i)
-		if(caves[i].platforms){
-			if(caves[i].xi<desiredX){
-				playerCave=i;
-				desiredX=caves[i].xi;
-				desiredY=caves[i].yi;
-			}
-			if(caves[i].xf<desiredX){
-				playerCave=i;
-				desiredX=caves[i].xf;
-				desiredY=caves[i].yf;
-			}
-		}
-	for(int x=0; x<tiles.readW(); ++x)
-		for(int y=0; y<tiles.readH(); ++y)
-			if(abs(x-desiredX)<8&&abs(y-desiredY)<8)
-				if(tiles.at(x, y)==EMPTY&&tiles.at(x, y-1)==WALL){
-					playerX=x;
-					playerY=y;
-					player.setPosition(TILE_SIZE*x, TILE_SIZE*y);
-					x=tiles.readW();//break out of outer loop too
-					break;
-				}
-	camera=player;
-	//add scuba suit somewhere accessible to the player
-	vector<pair<int, int> > scubaQueue;
-	scubaQueue.push_back(pair<int, int>(playerX, playerY));
-	set<pair<int, int> > potentialScubas;
-	set<pair<int, int> > visited;
-	while(scubaQueue.size()){
-		int x=scubaQueue.back().first;
-		int y=scubaQueue.back().second;
-		scubaQueue.pop_back();
-		if(visited.find(pair<int, int>(x, y))!=visited.end()) continue;
-		visited.insert(pair<int, int>(x, y));
-		if(x>tiles.readW()/3) continue;
-		if(tiles.at(x-1, y)==EMPTY||tiles.at(x+1, y)==EMPTY)
-			potentialScubas.insert(pair<int, int>(x, y));
-		if(tiles.at(x+1, y)==EMPTY) scubaQueue.push_back(pair<int, int>(x+1, y));
-		if(tiles.at(x-1, y)==EMPTY) scubaQueue.push_back(pair<int, int>(x-1, y));
-		if(tiles.at(x, y-1)==EMPTY) scubaQueue.push_back(pair<int, int>(x, y-1));
-	}
-	int scubaX, scubaY;
-	float furthest=0.0f;
-	for(int x=0; x<=tiles.readW()/3; ++x)
-		for(int y=0; y<tiles.readH(); ++y)
-			if(potentialScubas.find(pair<int, int>(x, y))!=potentialScubas.end()){
-				float distance=abs(x-playerX)+abs(y-playerY);
-				if(distance>furthest){
-					scubaX=x;
-					scubaY=y;
-					furthest=distance;
-				}
-			}
-	scuba.setPosition(TILE_SIZE*scubaX, TILE_SIZE*scubaY);
-	//set the buddy position to somewhere past a hi jump, prefer being on the right
-	set<unsigned> cavesPastHiJumps;
-	getCavesPastHiJumps(playerCave, caves, cavesPastHiJumps);
-	for(int x=tiles.readW()-1; x>=0; --x)
-		for(int y=0; y<tiles.readH(); ++y){
-			bool pastHiJump=false;
-			if(!cavesPastHiJumps.size()) pastHiJump=true;
-			for(
-				set<unsigned>::iterator i=cavesPastHiJumps.begin();
-				i!=cavesPastHiJumps.end();
-				++i
-			){
-				if(
-					(abs(x-int(caves[*i].xi))<8&&abs(y-int(caves[*i].yi))<8)
-					||
-					(abs(x-int(caves[*i].xf))<8&&abs(y-int(caves[*i].yf))<8)
-				)
-					pastHiJump=true;
-			}
-			if(pastHiJump&&tiles.at(x, y)==EMPTY&&tiles.at(x, y-1)==WALL){
-				buddy.setPosition(TILE_SIZE*x, TILE_SIZE*y);
-				x=-1;//break out of outer loop too
-				break;
-			}
-		}
-	//set the hi jump location to somewhere accessible with no powerups from start
-	set<unsigned> initiallyTerminalCaves;
-	getInitialTerminalCaves(playerCave, caves, initiallyTerminalCaves);
-	for(
-		set<unsigned>::iterator i=initiallyTerminalCaves.begin();
-		i!=initiallyTerminalCaves.end();
-		++i
-	){
-		Object hiJump;
-		if(!caves[*i].platforms)
-			hiJump.setPosition(TILE_SIZE*caves[*i].xi, TILE_SIZE*caves[*i].yi);
-		else{
-			desiredX=caves[*i].xf;
-			desiredY=caves[*i].yf;
-			for(int x=0; x<tiles.readW(); ++x)
-				for(int y=0; y<tiles.readH(); ++y)
-					if(abs(x-desiredX)<4&&abs(y-desiredY)<4)
-						if(tiles.at(x, y)==EMPTY&&tiles.at(x, y-1)==WALL){
-							hiJump.setPosition(TILE_SIZE*x, TILE_SIZE*y);
-							x=tiles.readW();//break out of outer loop too
-							break;
-						}
-		}
-		hiJumps.push_back(hiJump);
-	}
+	bodies.add(TILE_SIZE*world.playerX, TILE_SIZE*world.playerY, Bodies::SPLASHES);
+	bodies.add(TILE_SIZE*world.buddyX, TILE_SIZE*world.buddyY);
+	camera.setPosition(TILE_SIZE*world.playerX, TILE_SIZE*world.playerY);
+	for(unsigned i=0; i<world.hiJumps.size(); ++i)
+		pickups.add(
+			TILE_SIZE*world.hiJumps[i].first, TILE_SIZE*world.hiJumps[i].second, Pickups::HI_JUMP
+		);
+	pickups.add(TILE_SIZE*world.scubaX, TILE_SIZE*world.scubaY, Pickups::SCUBA);
+	chunksW=(world.tiles.readW()+CHUNK_SIZE-1)/CHUNK_SIZE;
+	chunksH=(world.tiles.readH()+CHUNK_SIZE-1)/CHUNK_SIZE;
 }
 
 void Game::jumpPressed(){ playerJumping=true; }
@@ -574,240 +336,197 @@ void Game::jumpReleased(){ playerJumping=false; }
 
 void Game::leftPressed(){
 	playerGoingLeft=true;
-	player.impulseX=-TILE_SIZE;
+	bodies.impulseX[PLAYER]=-TILE_SIZE;
 }
 
 void Game::leftReleased(){
 	playerGoingLeft=false;
-	player.vx/=2;
+	bodies.vx[PLAYER]/=2;
 }
 
 void Game::rightPressed(){
 	playerGoingRight=true;
-	player.impulseX=TILE_SIZE;
+	bodies.impulseX[PLAYER]=TILE_SIZE;
 }
 
 void Game::rightReleased(){
 	playerGoingRight=false;
-	player.vx/=2;
+	bodies.vx[PLAYER]/=2;
+}
+
+void Game::getVisibleChunks(unsigned width, unsigned height, vector<unsigned>& chunks) const{
+	float cameraX=readCameraX(), cameraY=readCameraY();
+	int xi=int((cameraX-width /2)/TILE_SIZE-1)/CHUNK_SIZE;
+	int yi=int((cameraY-height/2)/TILE_SIZE-1)/CHUNK_SIZE;
+	int xf=int((cameraX+width /2)/TILE_SIZE)/CHUNK_SIZE;
+	int yf=int((cameraY+height/2)/TILE_SIZE)/CHUNK_SIZE;
+	for(int x=max(xi, 0); x<=min(xf, int(chunksW)-1); ++x)
+		for(int y=max(yi, 0); y<=min(yf, int(chunksH)-1); ++y)
+			chunks.push_back(x*chunksH+y);
 }
 
 void Game::getQuadVertices(unsigned width, unsigned height, vector<Vertex>& vertices){
-	int xi=int((camera.x-width /2)/TILE_SIZE-1);
-	int yi=int((camera.y-height/2)/TILE_SIZE-1);
-	int xf=int((camera.x+width /2)/TILE_SIZE);
-	int yf=int((camera.y+height/2)/TILE_SIZE);
-	for(int x=xi; x<=xf; ++x)
-		for(int y=yi; y<=yf; ++y){
-			float r=0.0f, g=0.0f, b=0.0f;
-			switch(tiles.at(x, y)){
-				case WALL : r=1.0f; g=1.0f; b=1.0f; break;
-				case WATER: r=0.0f; g=0.0f; b=1.0f; break;
-				default: break;
-			}
-			if(tiles.at(x, y)==WALL){
-				pushTile(
-					TILE_SIZE*x-camera.x+TILE_SIZE*tiles.mondrianLAt(x, y),
-					TILE_SIZE*y-camera.y+TILE_SIZE*tiles.mondrianDAt(x, y),
-					(1-tiles.mondrianLAt(x, y)-tiles.mondrianRAt(x, y))*TILE_SIZE,
-					(1-tiles.mondrianDAt(x, y)-tiles.mondrianUAt(x, y))*TILE_SIZE,
-					r, g, b, vertices
-				);
-			}
-			else{
-				pushTile(
-					TILE_SIZE*x-camera.x,
-					TILE_SIZE*y-camera.y,
-					TILE_SIZE,
-					TILE_SIZE,
-					r, g, b, vertices
-				);
-			}
-		}
-	pushTile(
-		int(player.x/TILE_SIZE)*TILE_SIZE-camera.x,
-		int(player.y/TILE_SIZE)*TILE_SIZE-camera.y,
-		TILE_SIZE, TILE_SIZE,
-		1.0f*PLAYER_R, 1.0f*PLAYER_G, 1.0f*PLAYER_B,
-		vertices
-	);
-	pushTile(
-		int(buddy.x/TILE_SIZE)*TILE_SIZE-camera.x,
-		int(buddy.y/TILE_SIZE)*TILE_SIZE-camera.y,
-		TILE_SIZE, TILE_SIZE,
-		1.0f*PLAYER_R, 1.0f*PLAYER_G, 1.0f*PLAYER_B,
-		vertices
-	);
-	for(unsigned i=0; i<hiJumps.size(); ++i)
+	float cameraX=readCameraX(), cameraY=readCameraY();
+	for(unsigned i=0; i<bodies.size(); ++i)
 		pushTile(
-			int(hiJumps[i].x/TILE_SIZE)*TILE_SIZE-camera.x,
-			int(hiJumps[i].y/TILE_SIZE)*TILE_SIZE-camera.y,
+			bodies.drawnX(i, alpha)-cameraX,
+			bodies.drawnY(i, alpha)-cameraY,
 			TILE_SIZE, TILE_SIZE,
-			1.0f, 1.0f, 0.0f,
+			1.0f*PLAYER_R, 1.0f*PLAYER_G, 1.0f*PLAYER_B,
 			vertices
 		);
-	if(!scubaCollected){
+	for(unsigned i=0; i<pickups.size(); ++i){
+		bool scuba=pickups.readKind(i)==Pickups::SCUBA;
 		pushTile(
-			int(scuba.x/TILE_SIZE)*TILE_SIZE-camera.x,
-			int(scuba.y/TILE_SIZE)*TILE_SIZE-camera.y,
+			int(pickups.readX(i)/TILE_SIZE)*TILE_SIZE-cameraX,
+			int(pickups.readY(i)/TILE_SIZE)*TILE_SIZE-cameraY,
 			TILE_SIZE, TILE_SIZE,
-			0.0f, 0.0f, 1.0f,
+			scuba?0.0f:1.0f, scuba?0.0f:1.0f, scuba?1.0f:0.0f,
 			vertices
 		);
 	}
 }
 
+const vector<Vertex>& Game::getChunkVertices(unsigned chunk){
+	map<unsigned, vector<Vertex> >::iterator i=chunkVertices.find(chunk);
+	if(i!=chunkVertices.end()) return i->second;
+	vector<Vertex>& vertices=chunkVertices[chunk];
+	buildChunkVertices(chunk, vertices);
+	return vertices;
+}
+
+void Game::buildChunkVertices(unsigned chunk, vector<Vertex>& vertices){
+	unsigned cx=chunk/chunksH, cy=chunk%chunksH;
+	int xi=cx*CHUNK_SIZE, xf=min((cx+1)*CHUNK_SIZE, world.tiles.readW());
+	int yi=cy*CHUNK_SIZE, yf=min((cy+1)*CHUNK_SIZE, world.tiles.readH());
+	//empty tiles are just the black backdrop showing through
+	pushTile(
+		TILE_SIZE*xi, TILE_SIZE*yi,
+		TILE_SIZE*(xf-xi), TILE_SIZE*(yf-yi),
+		0.0f, 0.0f, 0.0f, vertices
+	);
+	//greedily merge walls and water into rectangles, row by row then upward
+	bool used[CHUNK_SIZE][CHUNK_SIZE]={};
+	for(int y=yi; y<yf; ++y)
+		for(int x=xi; x<xf; ++x){
+			Tile tile=world.tiles.at(x, y);
+			if((tile!=WALL&&tile!=WATER)||used[x-xi][y-yi]) continue;
+			int x2=x;
+			while(x2+1<xf&&!used[x2+1-xi][y-yi]&&joins(x2, y, x2+1, y)) ++x2;
+			int y2=y;
+			while(y2+1<yf){
+				bool rowJoins=joins(x, y2, x, y2+1)
+					&&world.tiles.mondrianLAt(x, y2+1)==world.tiles.mondrianLAt(x, y)
+					&&world.tiles.mondrianRAt(x2, y2+1)==world.tiles.mondrianRAt(x2, y);
+				for(int i=x; rowJoins&&i<=x2; ++i){
+					if(used[i-xi][y2+1-yi]) rowJoins=false;
+					else if(i<x2&&!joins(i, y2+1, i+1, y2+1)) rowJoins=false;
+				}
+				if(!rowJoins) break;
+				++y2;
+			}
+			for(int i=x; i<=x2; ++i)
+				for(int j=y; j<=y2; ++j)
+					used[i-xi][j-yi]=true;
+			if(tile==WALL)
+				pushTile(
+					TILE_SIZE*(x+world.tiles.mondrianLAt(x, y)),
+					TILE_SIZE*(y+world.tiles.mondrianDAt(x, y)),
+					(x2-x+1-world.tiles.mondrianLAt(x, y)-world.tiles.mondrianRAt(x2, y))*TILE_SIZE,
+					(y2-y+1-world.tiles.mondrianDAt(x, y)-world.tiles.mondrianUAt(x, y2))*TILE_SIZE,
+					1.0f, 1.0f, 1.0f, vertices
+				);
+			else
+				pushTile(
+					TILE_SIZE*x, TILE_SIZE*y,
+					TILE_SIZE*(x2-x+1), TILE_SIZE*(y2-y+1),
+					0.0f, 0.0f, 1.0f, vertices
+				);
+		}
+}
+
+//whether two neighbouring tiles can be drawn as one quad without losing a mondrian line
+bool Game::joins(int x1, int y1, int x2, int y2){
+	if(world.tiles.at(x1, y1)!=world.tiles.at(x2, y2)) return false;
+	if(world.tiles.at(x1, y1)!=WALL) return true;
+	if(x2>x1)
+		return world.tiles.mondrianRAt(x1, y1)==0.0f&&world.tiles.mondrianLAt(x2, y2)==0.0f
+			&&world.tiles.mondrianDAt(x1, y1)==world.tiles.mondrianDAt(x2, y2)
+			&&world.tiles.mondrianUAt(x1, y1)==world.tiles.mondrianUAt(x2, y2);
+	return world.tiles.mondrianUAt(x1, y1)==0.0f&&world.tiles.mondrianDAt(x2, y2)==0.0f;
+}
+
 int Game::update(){
 	float jumpVolume=0.2f;
 	//player
-	updateSquare(
-		player, playerJumping,
-		playerGoingLeft, playerGoingRight,
-		440.0f, jumpVolume, playerJump, playerHiJumpsCollected, scubaCollected, true
-	);
-	//hi jumps
-	for(unsigned i=0; i<hiJumps.size(); NULL){
-		if(abs(hiJumps[i].x-player.x)<TILE_SIZE&&abs(hiJumps[i].y-player.y)<TILE_SIZE){
-			++playerHiJumpsCollected;
-			hiJumps.erase(hiJumps.begin()+i);
-			powerup->perform("", &jumpVolume);
-		}
-		else ++i;
-	}
-	//scuba
-	if(!scubaCollected&&abs(scuba.x-player.x)<TILE_SIZE&&abs(scuba.y-player.y)<TILE_SIZE){
-		scubaCollected=true;
-		powerup->perform("", &jumpVolume);
-	}
-	//buddy
-	float attenuation=
-		(player.x-buddy.x)*(player.x-buddy.x)
-		+
-		(player.y-buddy.y)*(player.y-buddy.y)
+	bodies.controls[PLAYER]=Bodies::SPLASHES
+		|(playerJumping?Bodies::JUMPING:0)
+		|(playerGoingLeft?Bodies::LEFT:0)
+		|(playerGoingRight?Bodies::RIGHT:0)
+		|(scubaCollected?Bodies::SCUBA:0)
 	;
-	if(abs(player.x-buddy.x)+abs(player.y-buddy.y)<TILE_SIZE*12){
-		if(player.x>buddy.x){
-			buddyGoingRight=true;
-			buddyGoingLeft=false;
-		}
-		else{
-			buddyGoingLeft=true;
-			buddyGoingRight=false;
+	bodies.hiJumps[PLAYER]=playerHiJumpsCollected;
+	bodies.step(world.tiles, PLAYER, BUDDY, pool);
+	playSounds(PLAYER, playerJump, jumpVolume);
+	float playerX=bodies.x[PLAYER], playerY=bodies.y[PLAYER];
+	//pickups
+	Pickups::Kind kind;
+	while(pickups.take(playerX, playerY, kind)){
+		if(kind==Pickups::HI_JUMP) ++playerHiJumpsCollected;
+		else scubaCollected=true;
+		system->set(powerup, jumpVolume, soundDelay);
+	}
+	//buddies, they go for where the player has just moved to
+	buddyVolumes.resize(bodies.size());
+	for(unsigned i=BUDDY; i<bodies.size(); ++i){
+		float buddyX=bodies.x[i], buddyY=bodies.y[i];
+		float attenuation=(playerX-buddyX)*(playerX-buddyX)+(playerY-buddyY)*(playerY-buddyY);
+		attenuation/=1000.0f*TILE_SIZE*TILE_SIZE;
+		buddyVolumes[i]=jumpVolume/max(1.0f, attenuation);
+		unsigned char& controls=bodies.controls[i];
+		controls&=~Bodies::JUMPING;
+		if(abs(playerX-buddyX)+abs(playerY-buddyY)<TILE_SIZE*12){
+			controls&=~(Bodies::LEFT|Bodies::RIGHT);
+			controls|=playerX>buddyX?Bodies::RIGHT:Bodies::LEFT;
 		}
+		if(random.next()%(FPS*8)==0||(victory&&random.next()%(FPS)==0))
+			controls|=Bodies::JUMPING;
 	}
-	attenuation/=1000.0f*TILE_SIZE*TILE_SIZE;
-	attenuation=max(1.0f, attenuation);
-	updateSquare(
-		buddy, rand()%(FPS*8)==0||(victory&&rand()%(FPS)==0),
-		buddyGoingLeft, buddyGoingRight,
-		330.0f, jumpVolume/attenuation, buddyJump, 0, false, false
-	);
+	bodies.step(world.tiles, BUDDY, bodies.size(), pool);
+	for(unsigned i=BUDDY; i<bodies.size(); ++i) playSounds(i, buddyJump, buddyVolumes[i]);
 	//victory
-	if(abs(player.x-buddy.x)+abs(player.y-buddy.y)<TILE_SIZE*6) ++victory;
+	if(abs(playerX-bodies.x[BUDDY])+abs(playerY-bodies.y[BUDDY])<TILE_SIZE*6) ++victory;
 	//camera
 	const float cameraLag=1.5f;
-	camera.vx+=(player.x+8*player.vx/FPS-camera.x)/cameraLag;
-	camera.vy+=(player.y+8*player.vy/FPS-camera.y)/cameraLag;
+	camera.vx+=(playerX+8*bodies.vx[PLAYER]/FPS-camera.x)/cameraLag;
+	camera.vy+=(playerY+8*bodies.vy[PLAYER]/FPS-camera.y)/cameraLag;
 	camera.update();
 	const float cameraFriction=1.2f;
 	camera.vx/=cameraFriction;
 	camera.vy/=cameraFriction;
+	keepResident();
 	return victory;
 }
 
-void Game::updateSquare(
-	Object& square, bool jumping, bool left, bool right,
-	float jumpPitch, float jumpVolume, Component* jumpComponent,
-	unsigned hiJumpsCollected, bool scubaCollected, bool doSplash
-){
-	if(jumping){
-		bool grounded=
-			tiles.at(square.x/TILE_SIZE, square.y/TILE_SIZE-1)==WALL
-			&&
-			square.vy<=0
-		;
-		if(hiJumpsCollected||grounded){
-			if(grounded) square.vy=20*TILE_SIZE;
-			else square.vy=8*hiJumpsCollected*TILE_SIZE;
-			jumpComponent->perform("", &jumpVolume);
-		}
-	}
-	square.vy-=1.0f*GRAVITY/FPS;
-	const float playerGroundMovement=TILE_SIZE*2;
-	const float playerAirMovement=TILE_SIZE/2;
-	if(right){
-		if(square.framesSinceGrounded==0) square.vx+=playerGroundMovement;
-		else square.vx+=playerAirMovement;
-	}
-	else if(left){
-		if(square.framesSinceGrounded==0) square.vx-=playerGroundMovement;
-		else square.vx-=playerAirMovement;
-	}
-	if(square.framesSinceGrounded!=0){
-		const float playerAirFriction=1.01f;
-		square.vx/=playerAirFriction;
-		square.vy/=playerAirFriction;
-	}
-	const float speedLimit=TILE_SIZE*FPS;
-	if(square.vx>speedLimit) square.vx=speedLimit;
-	else if(square.vx<-speedLimit) square.vx=-speedLimit;
-	if(square.vy>speedLimit) square.vy=speedLimit;
-	else if(square.vy<-speedLimit) square.vy=-speedLimit;
-	square.update();
-	collideWithTiles(square, scubaCollected, jumpVolume, doSplash);
+void Game::playSounds(unsigned body, const System::Port& jump, float volume){
+	if(bodies.events[body]&Bodies::JUMPED) system->set(jump, volume, soundDelay);
+	if(bodies.events[body]&Bodies::BUMPED) system->set(playerBump, volume, soundDelay);
+	if(bodies.events[body]&Bodies::SPLASHED) system->set(splash, volume, soundDelay);
 }
 
-void Game::collideWithTiles(Object& object, bool scubaCollected, float volume, bool doSplash){
-	const float collisionFriction=1.5f;
-	int px=int(object.px/TILE_SIZE);
-	int py=int(object.py/TILE_SIZE);
-	bool done=false;
-	int x, y;
-	bool bumped=false;
-	while(!done){
-		x=int(object.x/TILE_SIZE);
-		y=int(object.y/TILE_SIZE);
-		switch(tiles.at(x, y)){
-			case WALL:
-				if(px!=x&&py!=y){
-					object.vx/=collisionFriction;
-					object.vy=0.0f;
-					object.y=object.py;
-					object.framesSinceGrounded=0;
-					bumped=true;
-					continue;
-				}
-				else if(px!=x){
-					object.vx=0.0f;
-					object.vy/=collisionFriction;
-					object.x=object.px;
-					object.framesSinceGrounded=0;
-					bumped=true;
-				}
-				else if(py!=y){
-					object.vx/=collisionFriction;
-					object.vy=0.0f;
-					object.y=object.py;
-					object.framesSinceGrounded=0;
-					bumped=true;
-				}
-				break;
-			default: break;
-		}
-		done=true;
-	}
-	if(bumped&&!object.bumped){
-		playerBump->perform("", &volume);
-	}
-	object.bumped=bumped;
-	if(object.splashed>0) --object.splashed;
-	if(doSplash&&!object.splashed&&tiles.at(x, y)==WATER){
-		splash->perform("", &volume);
-		object.splashed=30;
-	}
-	if(!scubaCollected&&tiles.at(x, y)==WATER){
-		const float waterFriction=2.0f;
-		object.vx/=waterFriction;
-		object.vy/=waterFriction;
+void Game::keepResident(){
+	int x=int(camera.x/TILE_SIZE), y=int(camera.y/TILE_SIZE);
+	world.tiles.keepResident(
+		x-RESIDENT_TILES, y-RESIDENT_TILES, x+RESIDENT_TILES, y+RESIDENT_TILES
+	);
+	//drop quads of chunks that have fallen out of range, they're rebuilt if they come back
+	int radius=RESIDENT_TILES/CHUNK_SIZE+1;
+	int cx=x/CHUNK_SIZE, cy=y/CHUNK_SIZE;
+	map<unsigned, vector<Vertex> >::iterator i=chunkVertices.begin();
+	while(i!=chunkVertices.end()){
+		int chunkX=i->first/chunksH, chunkY=i->first%chunksH;
+		if(abs(chunkX-cx)>radius||abs(chunkY-cy)>radius) chunkVertices.erase(i++);
+		else ++i;
 	}
 }
+
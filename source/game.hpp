@@ -2,13 +2,14 @@
 #define GAME_HPP_INCLUDED
 
 #include "dansAudioLab.hpp"
+#include "world.hpp"
 
+#include <map>
 #include <vector>
 
 const int FPS=30;
 const int TILE_SIZE=32;
-
-enum Tile{ EMPTY, WALL, STAY_EMPTY, WATER };
+const int RESIDENT_TILES=64;//how far from the camera tiles and their quads are kept around
 
 struct Vertex{
 	Vertex(float x, float y, float r, float g, float b):
@@ -24,131 +25,119 @@ struct Object{//object size is equal to tile size
 	{}
 	void setPosition(float x, float y);
 	void update();
+	//where to draw it, alpha of the way from where the last update started to where it ended
+	float drawnX(float alpha) const{ return px+(x-px)*alpha; }
+	float drawnY(float alpha) const{ return py+(y-py)*alpha; }
 	float x, y, px, py, vx, vy, impulseX, impulseY;
 	unsigned framesSinceGrounded;
 	bool bumped;
 	int splashed;
 };
 
-class Tiles{
-	public:
-		void resize(unsigned width, unsigned height){
-			w=width;
-			h=height;
-			tiles.resize(width*height, WALL);
-			mondrianL.resize(width*height, 0.0f);
-			mondrianR.resize(width*height, 0.0f);
-			mondrianU.resize(width*height, 0.0f);
-			mondrianD.resize(width*height, 0.0f);
-		}
-		Tile at(int x, int y) const{
-			if(x<0||x>=w||y<0||y>=h) return WALL;
-			return tiles[x*h+y];
-		}
-		float& mondrianLAt(int x, int y){
-			if(x<0||x>=w||y<0||y>=h) return mondrianL[0];
-			return mondrianL[x*h+y];
-		}
-		float& mondrianRAt(int x, int y){
-			if(x<0||x>=w||y<0||y>=h) return mondrianR[0];
-			return mondrianR[x*h+y];
-		}
-		float& mondrianUAt(int x, int y){
-			if(x<0||x>=w||y<0||y>=h) return mondrianU[0];
-			return mondrianU[x*h+y];
-		}
-		float& mondrianDAt(int x, int y){
-			if(x<0||x>=w||y<0||y>=h) return mondrianD[0];
-			return mondrianD[x*h+y];
-		}
-		void set(int x, int y, Tile tile){
-			if(x<0||x>=w||y<0||y>=h) return;
-			tiles[x*h+y]=tile;
-		}
-		unsigned readW() const{ return w; }
-		unsigned readH() const{ return h; }
+//Squares that move and collide with the tiles, like Objects, but kept a field at a time so a
+//step goes over every body with the same few plain loops, in batches across threads if there
+//are enough of them. Controls are set before a step, and events are what happened in it,
+//since sounds can't be played from the step.
+struct Bodies{
+	enum Control{ JUMPING=1, LEFT=2, RIGHT=4, SCUBA=8, SPLASHES=16 };
+	enum Event{ JUMPED=1, BUMPED=2, SPLASHED=4 };
+	unsigned add(float x, float y, unsigned char controls=0);
+	unsigned size() const{ return x.size(); }
+	float drawnX(unsigned i, float alpha) const{ return px[i]+(x[i]-px[i])*alpha; }
+	float drawnY(unsigned i, float alpha) const{ return py[i]+(y[i]-py[i])*alpha; }
+	//moves bodies begin to end a frame, the pool isn't used for streamed tiles
+	void step(const Tiles&, unsigned begin, unsigned end, ThreadPool* pool=NULL);
+	std::vector<float> x, y, px, py, vx, vy, impulseX, impulseY;
+	std::vector<unsigned> framesSinceGrounded;
+	std::vector<unsigned> hiJumps;//collected
+	std::vector<int> splashed;
+	std::vector<unsigned char> controls, events, bumped;
 	private:
-		std::vector<Tile> tiles;
-		std::vector<float> mondrianL;
-		std::vector<float> mondrianR;
-		std::vector<float> mondrianU;
-		std::vector<float> mondrianD;
-		unsigned w, h;
+		static const unsigned GRAVITY=TILE_SIZE*24;//pixels per second per second
+		static const unsigned MIN_BATCH=256;//bodies worth a job of their own
+		friend class BodiesJob;
+		void stepBatch(const Tiles&, unsigned begin, unsigned end);
+		void collide(const Tiles&, unsigned i);
 };
 
-struct Cave{
-	static void hole(
-		unsigned x, unsigned y, float size,
-		int platformStep, int platformSize, int platformSpace,
-		int platformXOffset, int platformYOffset,
-		bool platforms,
-		Tiles& tiles
-	);
-	
-	Cave(
-		unsigned xi, unsigned yi, unsigned xf, unsigned yf,
-		float size, bool platforms, int depth
-	):
-		xi(xi), yi(yi), xf(xf), yf(yf),
-		size(size), platforms(platforms), depth(depth)
-	{}
-	
-	void implement(Tiles& tiles);
-	bool addBranch(unsigned& x, unsigned& y);
-	
-	unsigned xi, yi, xf, yf;
-	float size;
-	bool platforms;
-	std::vector<float> branches;
-	int depth;
-	std::vector<unsigned> children;
-	unsigned parent;
-	unsigned connectionY;
+//Things lying around to be picked up, kept in buckets by the tile they're on, so finding what
+//a body touches takes the same few lookups however many there are.
+class Pickups{
+	public:
+		enum Kind{ HI_JUMP, SCUBA };
+		Pickups(): buckets(MIN_BUCKETS) {}
+		void add(float x, float y, Kind kind);
+		//removes a pickup less than a tile from x, y on both axes, false if there isn't one
+		bool take(float x, float y, Kind& kind);
+		//taking one moves the last in its place
+		unsigned size() const{ return xs.size(); }
+		float readX(unsigned i) const{ return xs[i]; }
+		float readY(unsigned i) const{ return ys[i]; }
+		Kind readKind(unsigned i) const{ return kinds[i]; }
+	private:
+		static const unsigned MIN_BUCKETS=64;
+		static int cell(float coordinate);
+		std::vector<unsigned>& bucket(int cellX, int cellY);
+		void remove(unsigned i);
+		std::vector<float> xs, ys;
+		std::vector<Kind> kinds;
+		std::vector<std::vector<unsigned> > buckets;//a power of 2 of them, at least one per pickup
 };
 
 class Game{
 	public:
-		int mondrianize(int x, int y, int dx, int dy, float size, bool lo);
-		Game(dal::System* system);
+		//bodies are stepped across the pool when there are enough of them
+		Game(dal::System* system, const World&, ThreadPool* pool=NULL);
 		void jumpPressed();
 		void jumpReleased();
 		void leftPressed();
 		void leftReleased();
 		void rightPressed();
 		void rightReleased();
-		unsigned readW() const{ return tiles.readW(); }
-		unsigned readH() const{ return tiles.readH(); }
+		unsigned readW() const{ return world.tiles.readW(); }
+		unsigned readH() const{ return world.tiles.readH(); }
+		//Drawing happens between updates, this is how far from the previous one to the latest.
+		//Updates always advance by 1/FPS seconds, however often frames are drawn.
+		void setInterpolation(float _alpha){ alpha=_alpha; }
+		//Sounds are triggered on the audio thread this many samples after it next takes them,
+		//so that ones from updates run together in one frame stay apart.
+		void setSoundDelay(unsigned samples){ soundDelay=samples; }
+		//Tile map quads never change, so they're built per chunk in world pixel coordinates
+		//when first asked for, and kept while the chunk is near the camera.
+		const std::vector<Vertex>& getChunkVertices(unsigned chunk);
+		void getVisibleChunks(unsigned width, unsigned height, std::vector<unsigned>&) const;
+		float readCameraX() const{ return camera.drawnX(alpha); }
+		float readCameraY() const{ return camera.drawnY(alpha); }
+		//quads for moving things, relative to the camera
 		void getQuadVertices(unsigned width, unsigned height, std::vector<Vertex>&);
 		int update();
 	private:
-		static const unsigned GRAVITY=TILE_SIZE*24;//pixels per second per second
 		static const unsigned PLAYER_R=1;
 		static const unsigned PLAYER_G=0;
 		static const unsigned PLAYER_B=0;
-		void updateSquare(
-			Object& square, bool jumping, bool left, bool right,
-			float jumpPitch, float jumpVolume, dal::Component* jumpComponent,
-			unsigned hiJumpsCollected, bool scubaCollected, bool doSplash
-		);
-		void collideWithTiles(Object&, bool scubaCollected, float volume, bool doSplash);
-		Object player, camera, buddy;
-		std::vector<Object> hiJumps;
-		Object scuba;
-		Tiles tiles;
+		static const unsigned PLAYER=0;//body
+		static const unsigned BUDDY=1;//the first of the buddy bodies, that follow the player
+		void playSounds(unsigned body, const dal::System::Port& jump, float volume);
+		void buildChunkVertices(unsigned chunk, std::vector<Vertex>&);
+		void keepResident();
+		bool joins(int x1, int y1, int x2, int y2);
+		Bodies bodies;
+		std::vector<float> buddyVolumes;//fainter further from the player
+		Object camera;
+		Pickups pickups;
+		World world;
+		Random random;
+		std::map<unsigned, std::vector<Vertex> > chunkVertices;//by column-major chunk index
+		unsigned chunksW, chunksH;
 		bool playerJumping, playerGoingRight, playerGoingLeft;
-		bool buddyGoingRight, buddyGoingLeft;
 		int victory;
-		dal::Component* playerJump;
-		dal::Component* buddyJump;
-		dal::Component* playerBump;
-		dal::Component* powerup;
-		dal::Component* splash;
+		dal::System* system;
+		unsigned soundDelay;
+		dal::System::Port playerJump, buddyJump, playerBump, powerup, splash;
 		unsigned playerHiJumpsCollected;
 		bool scubaCollected;
-		//these are members just because it's easier to debug this way
-		unsigned playerCave;
-		std::vector<Cave> caves;
-		unsigned seed;
+		float alpha;
+		ThreadPool* pool;
 };
 
 #endif
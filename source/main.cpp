@@ -3,20 +3,37 @@
 #include "sfml/audio.hpp"
 
 #include "game.hpp"
+#include "tileGenerator.hpp"
+#include "worldCache.hpp"
 
 #include "dansAudioLab.hpp"
 
-#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <map>
 #include <sstream>
+#include <string>
+#include <vector>
 
 using namespace std;
 using namespace dal;
 
-const sf::Time MIN_FRAME_DURATION=sf::seconds(1.0f/FPS);
+const sf::Time STEP_DURATION=sf::seconds(1.0f/FPS);//the game always updates at FPS
+const unsigned MAX_STEPS_PER_FRAME=4;//past this, a slow frame is dropped instead of caught up
+const sf::Time MIN_FRAME_DURATION=sf::seconds(1.0f/240);//drawing is capped in case vsync is off
 
 const unsigned SAMPLE_RATE=22050;
 const unsigned CHANNELS=1;
 const unsigned SAMPLES_AT_ONCE=1024;
+const unsigned AUDIO_WORKERS=1;//threads helping evaluate sounds, besides SFML's audio thread
+const double AUDIO_BUDGET=0.25*SAMPLES_AT_ONCE/SAMPLE_RATE;//seconds to evaluate a block in
+
+const unsigned LEVELS=4;
+const unsigned LEVEL_SIZE=256;//tiles per side, unless given on the command line
+const unsigned STREAM_SIZE=2048;//levels this big or bigger are streamed from their files
+const unsigned MAX_SF_CHUNKS=256;//converted tile chunks kept for drawing
 
 class SoundStream: public sf::SoundStream{
 	public:
@@ -27,8 +44,7 @@ class SoundStream: public sf::SoundStream{
 		bool onGetData(Chunk& data){
 			const float* samples=system->evaluate();
 			data.sampleCount=SAMPLES_AT_ONCE;
-			for(unsigned i=0; i<SAMPLES_AT_ONCE; ++i)
-				int16samples[i]=sf::Int16(samples[i]*0x7ffd);
+			toInt16(samples, SAMPLES_AT_ONCE, 0x7ffd, int16samples, &dither);
 			data.samples=int16samples;
 			return true;
 		}
@@ -36,9 +52,50 @@ class SoundStream: public sf::SoundStream{
 		void onSeek(sf::Time){}
 		//variables
 		sf::Int16 int16samples[SAMPLES_AT_ONCE];
+		Dither dither;
+		System* system;
+};
+
+//They sleep until the system wakes them to help with a level of sounds big enough to share.
+class AudioWorkers{
+	public:
+		AudioWorkers(System* system, unsigned workers): system(system), quitting(0){
+			for(unsigned i=0; i<workers; ++i){
+				threads.push_back(new sf::Thread(&AudioWorkers::work, this));
+				threads.back()->launch();
+			}
+			system->setWorkers(workers, &AudioWorkers::wake, this);
+		}
+		//the system mustn't be evaluating
+		~AudioWorkers(){
+			system->setWorkers(0, NULL, NULL);
+			__sync_lock_test_and_set(&quitting, 1);
+			for(unsigned i=0; i<threads.size(); ++i) wakes.post();
+			for(unsigned i=0; i<threads.size(); ++i){
+				threads[i]->wait();
+				delete threads[i];
+			}
+		}
+	private:
+		static void wake(void* workers, unsigned count){
+			for(unsigned i=0; i<count; ++i) ((AudioWorkers*)workers)->wakes.post();
+		}
+		void work(){
+			while(true){
+				wakes.wait();
+				if(__sync_fetch_and_add(&quitting, 0)) return;
+				while(system->work());
+			}
+		}
 		System* system;
+		vector<sf::Thread*> threads;
+		Semaphore wakes;
+		unsigned quitting;
 };
 
+sf::Clock audioClock;
+double readAudioClock(){ return audioClock.getElapsedTime().asMicroseconds()/1e6; }
+
 void push(std::string s, int r, int c, vector<vector<pair<float, int> > >& result){
 	result.resize(r);
 	for(int i=0; i<r; ++i) result[i].resize(c);
@@ -54,6 +111,14 @@ void push(std::string s, int r, int c, vector<vector<pair<float, int> > >& resul
 		}
 }
 
+//The directory of the path the game was started with, including the trailing separator.
+//A bare name, as when it's found on the PATH, gives the working directory.
+string getDirectory(const string& path){
+	size_t slash=path.find_last_of("/\\");
+	if(slash==string::npos) return "";
+	return path.substr(0, slash+1);
+}
+
 System* createSystem(){
 	//system
 	System* system=new System(SAMPLE_RATE, SAMPLES_AT_ONCE);
@@ -94,25 +159,68 @@ System* createSystem(){
 	system->addComponent("splash", new Noter(notes));
 	system->component("splash")>>system->component("adder");
 
+	if(system->build()) cerr<<"the sound graph has cycles, each was broken where it was added first\n";
 	return system;
 }
 
-int main(){
+//usage: ld26 [--seed <seed>] [--size <tiles per side>] [--lazy]
+//Levels use consecutive seeds from the given one, or from the time if there isn't one.
+//Generated levels are cached next to the executable, so a seed seen before loads instantly.
+//With --lazy, each level's tiles are instead generated around the camera as it moves,
+//so levels of any size start at once. They're different levels than without it.
+int main(int argc, char** argv){
 	//initialize
+	unsigned firstSeed=unsigned(time(NULL));
+	unsigned levelSize=LEVEL_SIZE;
+	bool lazy=false;
+	for(int i=1; i<argc; ++i){
+		if(string(argv[i])=="--seed"&&i+1<argc) firstSeed=strtoul(argv[++i], NULL, 10);
+		else if(string(argv[i])=="--size"&&i+1<argc) levelSize=max(atoi(argv[++i]), 64);
+		else if(string(argv[i])=="--lazy") lazy=true;
+	}
 	sf::RenderWindow window(sf::VideoMode(640, 480), "LD26", sf::Style::Close);
 	window.setKeyRepeatEnabled(false);
+	window.setVerticalSyncEnabled(true);
 	sf::Clock clock;
 	vector<Vertex> vertices;
 	sf::VertexArray sfVertices;
 	sfVertices.setPrimitiveType(sf::Quads);
+	vector<unsigned> visibleChunks;
+	sf::RectangleShape fade;
 	int maxFade=FPS*4;
 	int fadeOut=maxFade;
 	System* system=createSystem();
-	Component* adder=&system->component("adder");
+	System::Port volume=system->port("adder", "volume");
+	system->setBudget(AUDIO_BUDGET, readAudioClock);
+	AudioWorkers* audioWorkers=new AudioWorkers(system, AUDIO_WORKERS);
 	SoundStream soundStream(system);
-	Game game(system);
+	//levels are generated up front, side by side, unless they're lazy
+	vector<unsigned> seeds;
+	for(unsigned i=0; i<LEVELS; ++i) seeds.push_back(firstSeed+i);
+	//big levels are streamed from their cache files instead of kept in memory
+	vector<World> worlds;
+	vector<TileStream*> streams;
+	//lazy levels are started when they're reached, they share the generator
+	TileGenerator generator;
+	if(lazy){
+		worlds.resize(LEVELS);
+		worlds[0].generateLazily(seeds[0], levelSize, levelSize, generator);
+	}
+	else{
+		ThreadPool pool(LEVELS-1);
+		loadOrGenerateWorlds(
+			worlds, seeds, levelSize, levelSize, getDirectory(argv[0]), pool,
+			levelSize>=STREAM_SIZE?&streams:NULL
+		);
+	}
+	unsigned level=0;
+	Game* game=new Game(system, worlds[level]);
+	//tile chunks are converted when first seen and kept until there are too many
+	map<unsigned, sf::VertexArray> sfChunks;
 	sf::sleep(sf::seconds(0.1f));
 	soundStream.play();
+	sf::Time unsimulated;
+	clock.restart();
 	//loop
 	while(true){
 		//handle events
@@ -124,15 +232,15 @@ int main(){
 						case sf::Keyboard::Space:
 						case sf::Keyboard::W:
 						case sf::Keyboard::Up:
-							game.jumpPressed();
+							game->jumpPressed();
 							break;
 						case sf::Keyboard::A:
 						case sf::Keyboard::Left:
-							game.leftPressed();
+							game->leftPressed();
 							break;
 						case sf::Keyboard::D:
 						case sf::Keyboard::Right:
-							game.rightPressed();
+							game->rightPressed();
 							break;
 						default: break;
 					}
@@ -142,15 +250,15 @@ int main(){
 						case sf::Keyboard::Space:
 						case sf::Keyboard::W:
 						case sf::Keyboard::Up:
-							game.jumpReleased();
+							game->jumpReleased();
 							break;
 						case sf::Keyboard::A:
 						case sf::Keyboard::Left:
-							game.leftReleased();
+							game->leftReleased();
 							break;
 						case sf::Keyboard::D:
 						case sf::Keyboard::Right:
-							game.rightReleased();
+							game->rightReleased();
 							break;
 						default: break;
 					}
@@ -162,42 +270,99 @@ int main(){
 			}
 		}
 		if(!window.isOpen()) break;
-		if(fadeOut>=0){
-			//update
-			if(game.update()>FPS*4)
+		//update in fixed steps for however long the last frame took
+		unsimulated+=clock.restart();
+		if(unsimulated>STEP_DURATION*float(MAX_STEPS_PER_FRAME))
+			unsimulated=STEP_DURATION*float(MAX_STEPS_PER_FRAME);
+		//sounds of each update are delayed by as long as the updates before it in this frame
+		for(unsigned step=0; unsimulated>=STEP_DURATION; ++step){
+			unsimulated-=STEP_DURATION;
+			unsigned soundDelay=step*SAMPLE_RATE/FPS;
+			game->setSoundDelay(soundDelay);
+			if(game->update()>FPS*4)
 				if(fadeOut>0)
 					--fadeOut;
-			//draw
-			vertices.clear();
-			game.getQuadVertices(window.getSize().x, window.getSize().y, vertices);
-			sfVertices.clear();
-			for(unsigned i=0; i<vertices.size(); ++i)
-				sfVertices.append(sf::Vertex(
-					sf::Vector2f(
-						vertices[i].x+window.getSize().x/2,
-						-vertices[i].y+window.getSize().y/2
-					),
-					sf::Color(
-						255*vertices[i].r*fadeOut/maxFade,
-						255*vertices[i].g*fadeOut/maxFade,
-						255*vertices[i].b*fadeOut/maxFade
-					)
-				));
-			window.clear();
-			window.draw(sfVertices);
-			window.display();
+			if(fadeOut!=maxFade) system->set(volume, 1.0f*fadeOut/maxFade, soundDelay);
+			//next level
+			if(fadeOut==0&&level+1<worlds.size()){
+				delete game;
+				++level;
+				if(lazy) worlds[level].generateLazily(seeds[level], levelSize, levelSize, generator);
+				game=new Game(system, worlds[level]);
+				sfChunks.clear();
+				fadeOut=maxFade;
+				system->set(volume, 1.0f, soundDelay);
+			}
+		}
+		//draw
+		game->setInterpolation(1.0f*unsimulated.asMicroseconds()/STEP_DURATION.asMicroseconds());
+		window.clear(sf::Color::White);//outside the map is all wall
+		visibleChunks.clear();
+		game->getVisibleChunks(window.getSize().x, window.getSize().y, visibleChunks);
+		sf::Transform chunkTransform;
+		chunkTransform.translate(
+			window.getSize().x/2-game->readCameraX(),
+			window.getSize().y/2+game->readCameraY()
+		);
+		chunkTransform.scale(1.0f, -1.0f);
+		for(unsigned i=0; i<visibleChunks.size(); ++i){
+			unsigned chunk=visibleChunks[i];
+			map<unsigned, sf::VertexArray>::iterator sfChunk=sfChunks.find(chunk);
+			if(sfChunk==sfChunks.end()){
+				if(sfChunks.size()>=MAX_SF_CHUNKS) sfChunks.clear();
+				sfChunk=sfChunks.insert(make_pair(chunk, sf::VertexArray(sf::Quads))).first;
+				const vector<Vertex>& chunkVertices=game->getChunkVertices(chunk);
+				for(unsigned j=0; j<chunkVertices.size(); ++j)
+					sfChunk->second.append(sf::Vertex(
+						sf::Vector2f(chunkVertices[j].x, chunkVertices[j].y),
+						sf::Color(
+							255*chunkVertices[j].r,
+							255*chunkVertices[j].g,
+							255*chunkVertices[j].b
+						)
+					));
+			}
+			window.draw(sfChunk->second, chunkTransform);
 		}
+		vertices.clear();
+		game->getQuadVertices(window.getSize().x, window.getSize().y, vertices);
+		sfVertices.clear();
+		for(unsigned i=0; i<vertices.size(); ++i)
+			sfVertices.append(sf::Vertex(
+				sf::Vector2f(
+					vertices[i].x+window.getSize().x/2,
+					-vertices[i].y+window.getSize().y/2
+				),
+				sf::Color(
+					255*vertices[i].r,
+					255*vertices[i].g,
+					255*vertices[i].b
+				)
+			));
+		window.draw(sfVertices);
+		//fade by darkening everything instead of recoloring the cached chunks
 		if(fadeOut!=maxFade){
-			float volume=1.0f*fadeOut/maxFade;
-			adder->perform("volume", (void*)&volume);
+			fade.setSize(sf::Vector2f(window.getSize().x, window.getSize().y));
+			fade.setFillColor(sf::Color(0, 0, 0, 255-255*fadeOut/maxFade));
+			window.draw(fade);
 		}
+		window.display();
 		//regulate
-		sf::Time frameDuration=clock.restart();
+		sf::Time frameDuration=clock.getElapsedTime();
 		if(frameDuration<MIN_FRAME_DURATION)
 			sf::sleep(MIN_FRAME_DURATION-frameDuration);
 	}
 	//finish
 	soundStream.stop();
+	delete audioWorkers;
+	if(system->readOverruns())
+		cerr<<system->readOverruns()<<" sound blocks went over budget, the worst took "
+			<<system->readWorstEvaluate()*1000<<" ms\n";
+	if(system->readLateWorkers())
+		cerr<<system->readLateWorkers()<<" sound blocks stopped sharing, waiting on late workers\n";
+	delete game;
 	delete system;
+	worlds.clear();
+	for(unsigned i=0; i<streams.size(); ++i) delete streams[i];
 	return 0;
 }
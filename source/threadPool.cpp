@@ -0,0 +1,99 @@
+#include "threadPool.hpp"
+
+#include "sfml/system.hpp"
+
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <semaphore.h>
+#endif
+
+//=====class Semaphore=====//
+#ifdef _WIN32
+Semaphore::Semaphore(): handle(CreateSemaphoreA(NULL, 0, 0x7fffffff, NULL)) {}
+
+Semaphore::~Semaphore(){ CloseHandle(handle); }
+
+void Semaphore::post(){ ReleaseSemaphore(handle, 1, NULL); }
+
+void Semaphore::wait(){ WaitForSingleObject(handle, INFINITE); }
+#else
+Semaphore::Semaphore(): handle(new sem_t) { sem_init((sem_t*)handle, 0, 0); }
+
+Semaphore::~Semaphore(){
+	sem_destroy((sem_t*)handle);
+	delete (sem_t*)handle;
+}
+
+void Semaphore::post(){ sem_post((sem_t*)handle); }
+
+void Semaphore::wait(){ while(sem_wait((sem_t*)handle)!=0); }
+#endif
+
+//=====class ThreadPool=====//
+ThreadPool::ThreadPool(unsigned workers):
+	mutex(new sf::Mutex),
+	jobs(NULL),
+	next(0),
+	done(0),
+	quitting(false)
+{
+	for(unsigned i=0; i<workers; ++i){
+		threads.push_back(new sf::Thread(&ThreadPool::work, this));
+		threads.back()->launch();
+	}
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		sf::Lock lock(*mutex);
+		quitting=true;
+	}
+	for(unsigned i=0; i<threads.size(); ++i) wake.post();
+	for(unsigned i=0; i<threads.size(); ++i){
+		threads[i]->wait();
+		delete threads[i];
+	}
+	delete mutex;
+}
+
+void ThreadPool::run(const std::vector<Job*>& _jobs){
+	if(_jobs.empty()) return;
+	{
+		sf::Lock lock(*mutex);
+		jobs=&_jobs;
+		next=0;
+		done=0;
+	}
+	for(unsigned i=0; i<threads.size()&&i+1<_jobs.size(); ++i) wake.post();
+	while(doOne());
+	finished.wait();
+	sf::Lock lock(*mutex);
+	jobs=NULL;
+}
+
+void ThreadPool::work(){
+	while(true){
+		wake.wait();
+		{
+			sf::Lock lock(*mutex);
+			if(quitting) return;
+		}
+		while(doOne());
+	}
+}
+
+bool ThreadPool::doOne(){
+	Job* job=NULL;
+	{
+		sf::Lock lock(*mutex);
+		if(jobs&&next<jobs->size()) job=(*jobs)[next++];
+	}
+	if(!job) return false;
+	job->run();
+	sf::Lock lock(*mutex);
+	if(++done==jobs->size()) finished.post();
+	return true;
+}
@@ -0,0 +1,51 @@
+#ifndef THREADPOOL_HPP_INCLUDED
+#define THREADPOOL_HPP_INCLUDED
+
+#include <vector>
+
+namespace sf{
+	class Thread;
+	class Mutex;
+}
+
+//Counts posts, and wait blocks until there's one to take, for threads with nothing to do.
+//Posting never blocks, so threads that mustn't wait can still post.
+class Semaphore{
+	public:
+		Semaphore();
+		~Semaphore();
+		void post();
+		void wait();
+	private:
+		Semaphore(const Semaphore&);
+		Semaphore& operator=(const Semaphore&);
+		void* handle;
+};
+
+class Job{
+	public:
+		virtual ~Job(){}
+		virtual void run()=0;
+};
+
+//Runs batches of jobs on worker threads. The thread calling run helps out,
+//so a pool with no workers just runs everything in order. Workers sleep between batches.
+class ThreadPool{
+	public:
+		ThreadPool(unsigned workers);
+		~ThreadPool();
+		void run(const std::vector<Job*>& jobs);//returns once every job is done
+		unsigned readThreads() const{ return threads.size()+1; }
+	private:
+		void work();
+		bool doOne();
+		std::vector<sf::Thread*> threads;
+		sf::Mutex* mutex;
+		Semaphore wake;//posted for each worker a batch can use, or to quit
+		Semaphore finished;//posted by whoever finishes the last job of a batch
+		const std::vector<Job*>* jobs;
+		unsigned next, done;
+		bool quitting;
+};
+
+#endif
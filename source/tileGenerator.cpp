@@ -0,0 +1,143 @@
+#include "tileGenerator.hpp"
+
+#include "sfml/system.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+TileGenerator::TileGenerator(unsigned maxRegions):
+	TileRegions(maxRegions),
+	width(0),
+	height(0),
+	thread(NULL),
+	mutex(new sf::Mutex),
+	working(NONE),
+	quitting(false)
+{}
+
+TileGenerator::~TileGenerator(){
+	stop();
+	resize(0, 0);
+	delete mutex;
+}
+
+void TileGenerator::start(const World& _world, unsigned _width, unsigned _height){
+	stop();
+	resize(_width, _height);
+	world=_world;
+	world.tiles=Tiles();
+	width=_width;
+	height=_height;
+	regions.assign(readRegions(), vector<unsigned char>());
+	quitting=false;
+	thread=new sf::Thread(&TileGenerator::work, this);
+	thread->launch();
+}
+
+void TileGenerator::keepResident(int xLo, int yLo, int xHi, int yHi){
+	xLo-=LOOKAHEAD;
+	yLo-=LOOKAHEAD;
+	xHi+=LOOKAHEAD;
+	yHi+=LOOKAHEAD;
+	int regionsH=readRegionsH(), regionsW=regionsH?readRegions()/regionsH:0;
+	int rxLo=max(xLo, 0)/int(REGION_TILES), rxHi=min(xHi/int(REGION_TILES), regionsW-1);
+	int ryLo=max(yLo, 0)/int(REGION_TILES), ryHi=min(yHi/int(REGION_TILES), regionsH-1);
+	if(xHi<0||yHi<0) rxHi=-1;//the window is off the map
+	int rxMid=(rxLo+rxHi)/2, ryMid=(ryLo+ryHi)/2;
+	vector<pair<unsigned, vector<unsigned char>*> > done;
+	{
+		sf::Lock lock(*mutex);
+		done.swap(finished);
+		//what's wanted now replaces what was asked for before
+		vector<pair<int, unsigned> > wanted;
+		for(int rx=rxLo; rx<=rxHi; ++rx)
+			for(int ry=ryLo; ry<=ryHi; ++ry){
+				unsigned region=rx*regionsH+ry;
+				if(isResident(region)||region==working) continue;
+				bool isDone=false;
+				for(unsigned i=0; i<done.size(); ++i)
+					if(done[i].first==region) isDone=true;
+				if(!isDone) wanted.push_back(make_pair(abs(rx-rxMid)+abs(ry-ryMid), region));
+			}
+		sort(wanted.begin(), wanted.end());
+		requests.clear();
+		for(unsigned i=0; i<wanted.size(); ++i) requests.push_back(wanted[i].second);
+		//a busy thread looks for more when it's done, so only an idle one needs waking
+		if(requests.size()&&working==NONE) wake.post();
+	}
+	for(unsigned i=0; i<done.size(); ++i){
+		unsigned region=done[i].first;
+		//it may have been needed before it was finished
+		if(!isResident(region)){
+			regions[region].swap(*done[i].second);
+			install(region, &regions[region][0]);
+		}
+		delete done[i].second;
+	}
+	TileRegions::keepResident(xLo, yLo, xHi, yHi);
+}
+
+const unsigned char* TileGenerator::loadRegion(unsigned region){
+	{
+		sf::Lock lock(*mutex);
+		requests.erase(remove(requests.begin(), requests.end(), region), requests.end());
+		for(unsigned i=0; i<finished.size(); ++i)
+			if(finished[i].first==region){
+				regions[region].swap(*finished[i].second);
+				delete finished[i].second;
+				finished.erase(finished.begin()+i);
+				return &regions[region][0];
+			}
+	}
+	generate(region, regions[region]);
+	return &regions[region][0];
+}
+
+void TileGenerator::dropRegion(unsigned region, const unsigned char*){
+	vector<unsigned char>().swap(regions[region]);
+}
+
+void TileGenerator::stop(){
+	if(!thread) return;
+	{
+		sf::Lock lock(*mutex);
+		quitting=true;
+	}
+	wake.post();
+	thread->wait();
+	delete thread;
+	thread=NULL;
+	for(unsigned i=0; i<finished.size(); ++i) delete finished[i].second;
+	finished.clear();
+	requests.clear();
+}
+
+void TileGenerator::work(){
+	while(true){
+		unsigned region=NONE;
+		{
+			sf::Lock lock(*mutex);
+			if(quitting) return;
+			if(requests.size()){
+				region=requests.front();
+				requests.erase(requests.begin());
+			}
+			working=region;
+		}
+		if(region==NONE){
+			wake.wait();
+			continue;
+		}
+		vector<unsigned char>* bytes=new vector<unsigned char>;
+		generate(region, *bytes);
+		sf::Lock lock(*mutex);
+		finished.push_back(make_pair(region, bytes));
+		working=NONE;
+	}
+}
+
+void TileGenerator::generate(unsigned region, vector<unsigned char>& bytes) const{
+	unsigned regionsH=(height+REGION_TILES-1)/REGION_TILES;
+	world.generateRegion(region/regionsH, region%regionsH, width, height, bytes);
+}
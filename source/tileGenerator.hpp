@@ -0,0 +1,52 @@
+#ifndef TILEGENERATOR_HPP_INCLUDED
+#define TILEGENERATOR_HPP_INCLUDED
+
+#include "threadPool.hpp"
+#include "tileStream.hpp"
+#include "world.hpp"
+
+#include <utility>
+#include <vector>
+
+namespace sf{
+	class Thread;
+	class Mutex;
+}
+
+//Tiles generated a region at a time as they're needed, see World::generateLazily.
+//keepResident asks a background thread for the regions around the window, and takes the
+//ones it has finished. A region touched before it's ready is generated on the spot.
+//Regions only depend on the seed and where they are, so it doesn't matter which thread
+//made one, or whether it was dropped and made again.
+class TileGenerator: public TileRegions{
+	public:
+		TileGenerator(unsigned maxRegions=16);
+		~TileGenerator();
+		//the world must have its caves planned, and is copied for the background thread
+		void start(const World& world, unsigned width, unsigned height);
+		void keepResident(int xLo, int yLo, int xHi, int yHi);
+	protected:
+		const unsigned char* loadRegion(unsigned region);
+		void dropRegion(unsigned region, const unsigned char* view);
+	private:
+		static const int LOOKAHEAD=REGION_TILES/2;//how far past the window to generate ahead
+		static const unsigned NONE=~0u;
+		TileGenerator(const TileGenerator&);
+		TileGenerator& operator=(const TileGenerator&);
+		void stop();
+		void work();
+		void generate(unsigned region, std::vector<unsigned char>& bytes) const;
+		World world;
+		unsigned width, height;
+		std::vector<std::vector<unsigned char> > regions;//the resident ones
+		sf::Thread* thread;
+		sf::Mutex* mutex;
+		Semaphore wake;//posted when there are requests for an idle thread, or it should quit
+		//guarded by the mutex
+		std::vector<unsigned> requests;//nearest first
+		unsigned working;//what the background thread is generating, or NONE
+		std::vector<std::pair<unsigned, std::vector<unsigned char>*> > finished;
+		bool quitting;
+};
+
+#endif
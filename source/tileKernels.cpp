@@ -0,0 +1,135 @@
+#include "tileKernels.hpp"
+
+using namespace std;
+
+//=====helpers=====//
+const unsigned LO_BITS=0x55555555u;//the low bit of every 2 bit field
+
+//gathers the even bits of x into its low half
+unsigned unzip(unsigned x){
+	x&=LO_BITS;
+	x=(x|x>>1)&0x33333333u;
+	x=(x|x>>2)&0x0f0f0f0fu;
+	x=(x|x>>4)&0x00ff00ffu;
+	x=(x|x>>8)&0x0000ffffu;
+	return x;
+}
+
+//spreads the low half of x into its even bits
+unsigned zip(unsigned x){
+	x&=0x0000ffffu;
+	x=(x|x<<8)&0x00ff00ffu;
+	x=(x|x<<4)&0x0f0f0f0fu;
+	x=(x|x<<2)&0x33333333u;
+	x=(x|x<<1)&LO_BITS;
+	return x;
+}
+
+//rows of plane word k that are on the map
+unsigned rowMask(unsigned h, unsigned k){
+	if(h>=32*(k+1)) return ~0u;
+	if(h<=32*k) return 0;
+	return (1u<<(h-32*k))-1;
+}
+
+//word k of a plane moved down a row, so bit y holds row y+1, filling past the end
+unsigned above(const vector<unsigned>& plane, unsigned k, unsigned fill){
+	unsigned next=k+1<plane.size()?plane[k+1]:fill;
+	return plane[k]>>1|next<<31;
+}
+
+//=====kernels=====//
+unsigned matchTiles(unsigned word, Tile tile){
+	unsigned x=word^(tile*LO_BITS);
+	return ~(x|x>>1)&LO_BITS;
+}
+
+void readColumn(const Tiles& tiles, int x, TileColumn& column){
+	unsigned chunksH=tiles.readChunksH();
+	unsigned words=(chunksH+1)/2;
+	//WALL is low bit set, high bit clear
+	column.lo.assign(words, ~0u);
+	column.hi.assign(words, 0);
+	if(x<0||x>=int(tiles.readW())) return;
+	for(unsigned k=0; k<words; ++k){
+		column.lo[k]=column.hi[k]=0;
+		for(unsigned half=0; half<2&&2*k+half<chunksH; ++half){
+			unsigned word=tiles.readChunkColumn(x, 2*k+half);
+			column.lo[k]|=unzip(word)<<(16*half);
+			column.hi[k]|=unzip(word>>1)<<(16*half);
+		}
+		unsigned outside=~rowMask(tiles.readH(), k);
+		column.lo[k]|=outside;
+		column.hi[k]&=~outside;
+	}
+}
+
+void writeColumn(Tiles& tiles, int x, const TileColumn& column){
+	if(x<0||x>=int(tiles.readW())) return;
+	unsigned chunksH=tiles.readChunksH();
+	for(unsigned k=0; k<column.lo.size(); ++k)
+		for(unsigned half=0; half<2&&2*k+half<chunksH; ++half){
+			unsigned fields=zip(column.lo[k]>>(16*half))|zip(column.hi[k]>>(16*half))<<1;
+			unsigned keep=~(zip(rowMask(tiles.readH(), k)>>(16*half))*3);//tiles past the top
+			unsigned word=tiles.readChunkColumn(x, 2*k+half);
+			tiles.writeChunkColumn(x, 2*k+half, (word&keep)|(fields&~keep));
+		}
+}
+
+void replaceTiles(Tiles& tiles, Tile from, Tile to){
+	unsigned chunksH=tiles.readChunksH();
+	//the top row of chunks may stick out past the map, so only it needs masking
+	unsigned topRows=tiles.readH()-(chunksH-1)*CHUNK_SIZE;
+	unsigned topMask=topRows==CHUNK_SIZE?LO_BITS:LO_BITS&((1u<<(2*topRows))-1);
+	for(unsigned x=0; x<tiles.readW(); ++x)
+		for(unsigned cy=0; cy<chunksH; ++cy){
+			unsigned word=tiles.readChunkColumn(x, cy);
+			unsigned matches=matchTiles(word, from);
+			if(cy+1==chunksH) matches&=topMask;
+			if(!matches) continue;
+			unsigned fields=matches*3;
+			tiles.writeChunkColumn(x, cy, (word&~fields)|(to*LO_BITS&fields));
+		}
+}
+
+void removeDiagonals(Tiles& tiles){
+	//Candidate windows between two columns come from whole words of bit planes.
+	//Emptying window x, y can only change later windows x, y+1, which it rules out
+	//since its tiles in row y+1 are now the same, and windows x+1, which are found
+	//from column x+1 after this pair of columns is done with it.
+	TileColumn a, b;
+	readColumn(tiles, 0, a);
+	bool aChanged=false;
+	for(int x=0; x<int(tiles.readW()); ++x){
+		readColumn(tiles, x+1, b);
+		bool bChanged=false;
+		unsigned carry=0;//the last window of the previous word was emptied
+		for(unsigned k=0; k<a.lo.size(); ++k){
+			//c and d are above a and b
+			unsigned cLo=above(a.lo, k, 1), cHi=above(a.hi, k, 0);
+			unsigned dLo=above(b.lo, k, 1), dHi=above(b.hi, k, 0);
+			unsigned ab=(a.lo[k]^b.lo[k])|(a.hi[k]^b.hi[k]);
+			unsigned ad=(a.lo[k]^dLo)|(a.hi[k]^dHi);
+			unsigned bc=(b.lo[k]^cLo)|(b.hi[k]^cHi);
+			unsigned windows=ab&~ad&~bc&rowMask(tiles.readH(), k)&~carry;
+			//bottom up, emptying a window rules out the one above it
+			unsigned emptied=0;
+			while(windows){
+				unsigned bit=windows&(~windows+1);
+				emptied|=bit;
+				windows&=~(bit|bit<<1);
+			}
+			unsigned rows=(emptied|emptied<<1|carry)&rowMask(tiles.readH(), k);
+			carry=emptied>>31;
+			if(!rows) continue;
+			a.lo[k]&=~rows;
+			a.hi[k]&=~rows;
+			b.lo[k]&=~rows;
+			b.hi[k]&=~rows;
+			aChanged=bChanged=true;
+		}
+		if(aChanged) writeColumn(tiles, x, a);
+		swap(a, b);
+		aChanged=bChanged;
+	}
+}
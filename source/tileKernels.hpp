@@ -0,0 +1,29 @@
+#ifndef TILEKERNELS_HPP_INCLUDED
+#define TILEKERNELS_HPP_INCLUDED
+
+#include "world.hpp"
+
+#include <vector>
+
+//Whole-grid passes over the packed tile storage. They work on 32 bit words, a chunk column of
+//16 tiles at a time, with plain integer ops so they run the same on any compiler and CPU.
+//Tiles past the top and right edges read as WALL, like Tiles::at, and are never written.
+
+//the low bit of each 2 bit field of word that holds tile
+unsigned matchTiles(unsigned word, Tile tile);
+
+//A whole column as bit planes, bit y of lo and hi being the low and high bit of tile y.
+//There's a bit for every row up to a multiple of 32, the ones past the top are WALL.
+struct TileColumn{
+	std::vector<unsigned> lo, hi;
+};
+//columns outside the map read as all WALL
+void readColumn(const Tiles& tiles, int x, TileColumn& column);
+void writeColumn(Tiles& tiles, int x, const TileColumn& column);
+
+void replaceTiles(Tiles& tiles, Tile from, Tile to);
+//Empties every 2x2 window with the same tile on one diagonal and another tile on the other,
+//with the same result as checking windows column by column, bottom up, in place.
+void removeDiagonals(Tiles& tiles);
+
+#endif
@@ -0,0 +1,191 @@
+#include "tileStream.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+//=====class MappedFile=====//
+#ifdef _WIN32
+MappedFile::MappedFile(): size(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {}
+
+bool MappedFile::open(const string& fileName){
+	close();
+	file=CreateFileA(
+		fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+	);
+	if(file==INVALID_HANDLE_VALUE) return false;
+	DWORD high;
+	DWORD low=GetFileSize(file, &high);
+	if(low==INVALID_FILE_SIZE&&GetLastError()!=NO_ERROR){
+		close();
+		return false;
+	}
+	size=(unsigned long long)high<<32|low;
+	if(size==0){
+		close();
+		return false;
+	}
+	mapping=CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!mapping){
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close(){
+	if(mapping) CloseHandle(mapping);
+	if(file!=INVALID_HANDLE_VALUE) CloseHandle(file);
+	size=0;
+	mapping=NULL;
+	file=INVALID_HANDLE_VALUE;
+}
+
+const unsigned char* MappedFile::map(unsigned long long offset, unsigned bytes){
+	if(!mapping||offset%ALIGNMENT||offset>size||bytes>size-offset) return NULL;
+	return (const unsigned char*)MapViewOfFile(
+		mapping, FILE_MAP_READ, DWORD(offset>>32), DWORD(offset), bytes
+	);
+}
+
+void MappedFile::unmap(const unsigned char* view, unsigned){
+	if(view) UnmapViewOfFile(view);
+}
+#else
+MappedFile::MappedFile(): size(0), file(-1) {}
+
+bool MappedFile::open(const string& fileName){
+	close();
+	file=::open(fileName.c_str(), O_RDONLY);
+	if(file<0) return false;
+	struct stat status;
+	if(fstat(file, &status)!=0||status.st_size==0){
+		close();
+		return false;
+	}
+	size=status.st_size;
+	return true;
+}
+
+void MappedFile::close(){
+	if(file>=0) ::close(file);
+	size=0;
+	file=-1;
+}
+
+const unsigned char* MappedFile::map(unsigned long long offset, unsigned bytes){
+	if(file<0||offset%ALIGNMENT||offset>size||bytes>size-offset) return NULL;
+	//without large file support off_t is 32 bits, and fstat fails on files too big for it
+	if((unsigned long long)off_t(offset)!=offset) return NULL;
+	void* view=mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, file, off_t(offset));
+	if(view==MAP_FAILED) return NULL;
+	return (const unsigned char*)view;
+}
+
+void MappedFile::unmap(const unsigned char* view, unsigned bytes){
+	if(view) munmap((void*)view, bytes);
+}
+#endif
+
+MappedFile::~MappedFile(){ close(); }
+
+//=====class TileRegions=====//
+TileRegions::TileRegions(unsigned maxRegions):
+	w(0), h(0), regionsH(0), now(0), resident(0), maxRegions(maxRegions)
+{}
+
+void TileRegions::resize(unsigned width, unsigned height){
+	for(unsigned i=0; i<views.size(); ++i)
+		if(views[i]&&!isMissing(i)) dropRegion(i, views[i]);
+	w=width;
+	h=height;
+	regionsH=(h+REGION_TILES-1)/REGION_TILES;
+	unsigned regions=(w+REGION_TILES-1)/REGION_TILES*regionsH;
+	views.assign(regions, NULL);
+	lastUse.assign(regions, 0);
+	resident=0;
+}
+
+void TileRegions::keepResident(int xLo, int yLo, int xHi, int yHi){
+	++now;
+	//drop the stalest regions outside the window until few enough are left
+	while(resident>maxRegions){
+		unsigned stalest=views.size();
+		for(unsigned i=0; i<views.size(); ++i){
+			if(!views[i]||isMissing(i)) continue;
+			int x=i/regionsH*REGION_TILES, y=i%regionsH*REGION_TILES;
+			if(x<=xHi&&x+int(REGION_TILES)>xLo&&y<=yHi&&y+int(REGION_TILES)>yLo) continue;
+			if(stalest==views.size()||lastUse[i]<lastUse[stalest]) stalest=i;
+		}
+		if(stalest==views.size()) break;//everything loaded is in the window
+		dropRegion(stalest, views[stalest]);
+		views[stalest]=NULL;
+		--resident;
+	}
+}
+
+void TileRegions::install(unsigned region, const unsigned char* view){
+	views[region]=view;
+	lastUse[region]=now;
+	++resident;
+}
+
+const unsigned char* TileRegions::fetchRegion(unsigned region){
+	views[region]=loadRegion(region);
+	if(views[region]){
+		++resident;
+		return views[region];
+	}
+	if(missing.empty()){
+		missing.assign(REGION_BYTES, 0);
+		unsigned char wall=WALL|WALL<<2|WALL<<4|WALL<<6;
+		fill(missing.begin(), missing.begin()+REGION_TYPE_BYTES, wall);
+	}
+	//kept in its place so it isn't tried again on every touch, it takes no memory of its own
+	views[region]=&missing[0];
+	return views[region];
+}
+
+//=====class TileStream=====//
+TileStream::TileStream(unsigned maxRegions): TileRegions(maxRegions), regionsOffset(0) {}
+
+TileStream::~TileStream(){ close(); }
+
+bool TileStream::open(
+	const string& fileName, unsigned width, unsigned height, unsigned _regionsOffset
+){
+	close();
+	if(!file.open(fileName)) return false;
+	regionsOffset=_regionsOffset;
+	resize(width, height);
+	if(
+		regionsOffset%MappedFile::ALIGNMENT
+		||
+		file.readSize()<regionsOffset+(unsigned long long)readRegions()*REGION_BYTES
+	){
+		close();
+		return false;
+	}
+	return true;
+}
+
+void TileStream::close(){
+	resize(0, 0);
+	file.close();
+}
+
+const unsigned char* TileStream::loadRegion(unsigned region){
+	return file.map(regionsOffset+(unsigned long long)region*REGION_BYTES, REGION_BYTES);
+}
+
+void TileStream::dropRegion(unsigned, const unsigned char* view){
+	file.unmap(view, REGION_BYTES);
+}
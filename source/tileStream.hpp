@@ -0,0 +1,117 @@
+#ifndef TILESTREAM_HPP_INCLUDED
+#define TILESTREAM_HPP_INCLUDED
+
+#include "world.hpp"
+
+#include <string>
+#include <vector>
+
+//A read only file that parts of can be memory-mapped, so nothing is read until it's touched.
+class MappedFile{
+	public:
+		//offsets of views must be multiples of this, it suits both Windows and POSIX
+		static const unsigned ALIGNMENT=65536;
+		MappedFile();
+		~MappedFile();
+		bool open(const std::string& fileName);
+		void close();
+		unsigned long long readSize() const{ return size; }
+		//NULL if it can't be mapped
+		const unsigned char* map(unsigned long long offset, unsigned bytes);
+		void unmap(const unsigned char* view, unsigned bytes);
+	private:
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+		unsigned long long size;
+#ifdef _WIN32
+		void* file;
+		void* mapping;
+#else
+		int file;
+#endif
+};
+
+//World files keep tiles in regions of REGION_CHUNKS by REGION_CHUNKS chunks, column-major
+//both between and within regions. A region is the types of all its chunks, then their insets,
+//padded out with WALL past the edge of the map, and starts on a MappedFile::ALIGNMENT boundary.
+const unsigned REGION_CHUNKS=32;
+const unsigned REGION_TILES=REGION_CHUNKS*CHUNK_SIZE;//per side
+const unsigned REGION_TYPE_BYTES=REGION_CHUNKS*REGION_CHUNKS*CHUNK_TYPE_BYTES;
+const unsigned REGION_BYTES=REGION_CHUNKS*REGION_CHUNKS*(CHUNK_TYPE_BYTES+CHUNK_INSET_BYTES);
+
+//Tiles kept a region at a time, wherever the regions come from. A region is loaded when
+//it's first touched, and stays until keepResident finds more than maxRegions loaded, then the
+//ones that are outside the window and were used longest ago go. So only what's around the
+//camera, plus whatever was touched recently, takes up memory.
+//Regions are only touched and dropped on the thread using the tiles.
+class TileRegions{
+	public:
+		TileRegions(unsigned maxRegions);
+		virtual ~TileRegions(){}
+		unsigned readW() const{ return w; }
+		unsigned readH() const{ return h; }
+		const unsigned char* getChunkTypes(unsigned chunkX, unsigned chunkY){
+			return getRegion(chunkX, chunkY)+getChunkInRegion(chunkX, chunkY)*CHUNK_TYPE_BYTES;
+		}
+		const unsigned char* getChunkInsets(unsigned chunkX, unsigned chunkY){
+			return
+				getRegion(chunkX, chunkY)+REGION_TYPE_BYTES
+				+
+				getChunkInRegion(chunkX, chunkY)*CHUNK_INSET_BYTES
+			;
+		}
+		//in tiles
+		virtual void keepResident(int xLo, int yLo, int xHi, int yHi);
+		unsigned readResidentRegions() const{ return resident; }
+	protected:
+		//forgets every region, so derived classes must call this before they're destroyed
+		void resize(unsigned width, unsigned height);
+		unsigned readRegions() const{ return views.size(); }
+		unsigned readRegionsH() const{ return regionsH; }
+		//regions that failed to load count, since they aren't tried again
+		bool isResident(unsigned region) const{ return views[region]!=NULL; }
+		//for regions that were loaded ahead of being touched
+		void install(unsigned region, const unsigned char* view);
+		//NULL if the region can't be had, it then reads as all WALL until the next resize
+		virtual const unsigned char* loadRegion(unsigned region)=0;
+		virtual void dropRegion(unsigned region, const unsigned char* view)=0;
+	private:
+		TileRegions(const TileRegions&);
+		TileRegions& operator=(const TileRegions&);
+		static unsigned getChunkInRegion(unsigned chunkX, unsigned chunkY){
+			return chunkX%REGION_CHUNKS*REGION_CHUNKS+chunkY%REGION_CHUNKS;
+		}
+		const unsigned char* getRegion(unsigned chunkX, unsigned chunkY){
+			unsigned region=chunkX/REGION_CHUNKS*regionsH+chunkY/REGION_CHUNKS;
+			lastUse[region]=now;
+			if(views[region]) return views[region];
+			return fetchRegion(region);
+		}
+		const unsigned char* fetchRegion(unsigned region);
+		bool isMissing(unsigned region) const{ return !missing.empty()&&views[region]==&missing[0]; }
+		unsigned w, h, regionsH;
+		std::vector<const unsigned char*> views;//NULL if not loaded, missing if it failed to
+		std::vector<unsigned> lastUse;//keepResident calls so far when last touched
+		unsigned now, resident, maxRegions;
+		std::vector<unsigned char> missing;//stands in for regions that fail to load, all WALL
+};
+
+//Tiles read from a world file, each region mapped into memory.
+class TileStream: public TileRegions{
+	public:
+		TileStream(unsigned maxRegions=8);
+		~TileStream();
+		//regionsOffset is where the first region starts in the file
+		bool open(
+			const std::string& fileName, unsigned width, unsigned height, unsigned regionsOffset
+		);
+		void close();
+	protected:
+		const unsigned char* loadRegion(unsigned region);
+		void dropRegion(unsigned region, const unsigned char* view);
+	private:
+		MappedFile file;
+		unsigned regionsOffset;
+};
+
+#endif
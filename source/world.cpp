@@ -0,0 +1,912 @@
+#include "world.hpp"
+
+#include "tileGenerator.hpp"
+#include "tileKernels.hpp"
+#include "tileStream.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+//=====helpers=====//
+bool intersects(
+	float xi1, float yi1, float dx1, float dy1,
+	float xi2, float yi2, float dx2, float dy2,
+	float tAllowance, float sAllowance
+){
+	if(dx2*dy1-dy2*dx1==0) return false;
+	if(dx2!=0){
+		float t=(yi2+dy2*(xi1-xi2)/dx2-yi1)*dx2/(dx2*dy1-dy2*dx1);
+		if(t<tAllowance||t>1-tAllowance) return false;
+		float s=(xi1+dx1*t-xi2)/dx2;
+		if(s<sAllowance||s>1-sAllowance) return false;
+	}
+	else{
+		float t=-(xi2+dx2*(yi1-yi2)/dy2-xi1)*dy2/(dx2*dy1-dy2*dx1);
+		if(t<tAllowance||t>1-tAllowance) return false;
+		float s=(yi1+dy1*t-yi2)/dy2;
+		if(s<sAllowance||s>1-sAllowance) return false;
+	}
+	return true;
+}
+
+float linear(float a, float b, float bness){
+	return a*(1-bness)+b*bness;
+}
+
+int clamp(int i, int lo, int hi){
+	if(i<lo) return lo;
+	if(i>hi) return hi;
+	return i;
+}
+
+//Lays out the mondrian lines. Which tiles have any inset is kept in bitmaps by row and
+//by column, so finding where a line stops skips over empty words instead of walking tiles.
+class MondrianLayout{
+	public:
+		MondrianLayout(Tiles& tiles):
+			tiles(tiles), w(tiles.readW()), h(tiles.readH()),
+			rowWords((w+31)/32), columnWords((h+31)/32),
+			rows(rowWords*h, 0), columns(columnWords*w, 0)
+		{}
+		bool occupied(int x, int y) const{
+			return (rows[y*rowWords+x/32]>>(x%32))&1;
+		}
+		//Runs a line from x, y in direction dx, dy until it reaches a tile with an inset,
+		//and returns how many tiles without one it crossed. If size isn't negative,
+		//the line is painted, including the tile it stopped at unless that tile
+		//already has an inset on the side facing the line.
+		int line(int x, int y, int dx, int dy, float size, bool lo){
+			if(x<0||y<0||x>=int(w)||y>=int(h)) return 0;
+			int n;
+			if(dx) n=distance(&rows[y*rowWords], w, x, dx);
+			else n=distance(&columns[x*columnWords], h, y, dy);
+			if(size<0) return n;
+			for(int i=0; i<n; ++i) paint(x+i*dx, y+i*dy, dx, size, lo);
+			int ex=x+n*dx, ey=y+n*dy;
+			if(ex<0||ey<0||ex>=int(w)||ey>=int(h)) return n;
+			if(dx>0&&tiles.mondrianLAt(ex, ey)!=0.0f) return n;
+			if(dy>0&&tiles.mondrianDAt(ex, ey)!=0.0f) return n;
+			if(dx<0&&tiles.mondrianRAt(ex, ey)!=0.0f) return n;
+			if(dy<0&&tiles.mondrianUAt(ex, ey)!=0.0f) return n;
+			paint(ex, ey, dx, size, lo);
+			return n;
+		}
+	private:
+		//bits from i in direction step before a set one or the end of the n bits
+		static int distance(const unsigned* bits, int n, int i, int step){
+			int j=i;
+			while(j>=0&&j<n){
+				unsigned word=bits[j/32];
+				if(step>0) word&=~0u<<(j%32);
+				else word&=~0u>>(31-j%32);
+				if(!word){
+					j=step>0?(j|31)+1:(j&~31)-1;
+					continue;
+				}
+				int bit=step>0?0:31;
+				while(!((word>>bit)&1)) bit+=step;
+				return (j&~31)+bit-i>0?(j&~31)+bit-i:i-(j&~31)-bit;
+			}
+			return step>0?n-i:i+1;
+		}
+		void paint(int x, int y, int dx, float size, bool lo){
+			if(dx!=0){
+				if(lo) tiles.setMondrianD(x, y, size);
+				else tiles.setMondrianU(x, y, size);
+			}
+			else{
+				if(lo) tiles.setMondrianL(x, y, size);
+				else tiles.setMondrianR(x, y, size);
+			}
+			if(size==0.0f) return;
+			rows[y*rowWords+x/32]|=1u<<(x%32);
+			columns[x*columnWords+y/32]|=1u<<(y%32);
+		}
+		Tiles& tiles;
+		unsigned w, h, rowWords, columnWords;
+		vector<unsigned> rows, columns;
+};
+
+//lays out up to count randomly placed mondrian lines, each crossing the shorter way
+void layMondrianLines(Tiles& tiles, Random& random, unsigned count){
+	MondrianLayout mondrian(tiles);
+	for(unsigned i=0; i<count; ++i){
+		float size=0.1f+0.2f*random.unit();
+		int x=random.next()%tiles.readW();
+		int y=random.next()%tiles.readH();
+		bool lo=random.next()%2;
+		if(mondrian.occupied(x, y)) continue;
+		int w=mondrian.line(x, y, 1, 0, -1.0f, lo)+mondrian.line(x, y, -1, 0, -1.0f, lo);
+		int h=mondrian.line(x, y, 0, 1, -1.0f, lo)+mondrian.line(x, y, 0, -1, -1.0f, lo);
+		if(w<h){
+			mondrian.line(x, y, 1, 0, size, lo);
+			mondrian.line(x-1, y, -1, 0, size, lo);
+		}
+		else{
+			mondrian.line(x, y, 0, 1, size, lo);
+			mondrian.line(x, y-1, 0, -1, size, lo);
+		}
+	}
+}
+
+//pushes x, y if it's empty, false if it's empty but outside the visitor's window
+static bool flowInto(const Tiles& tiles, GridVisitor& visitor, int x, int y){
+	if(tiles.at(x, y)!=EMPTY) return true;
+	return visitor.push(x, y)||visitor.visited(x, y);
+}
+
+//Fills with water from x, y down, and sideways wherever it can't go down.
+//If the water would flow out of the visitor's window, the tiles are left as they were.
+void pourWater(Tiles& tiles, GridVisitor& visitor, int x, int y){
+	vector<pair<int, int> > poured;
+	bool contained=true;
+	visitor.push(x, y);
+	int wx, wy;
+	while(contained&&visitor.pop(wx, wy)){
+		tiles.set(wx, wy, WATER);
+		poured.push_back(pair<int, int>(wx, wy));
+		if(tiles.at(wx, wy-1)==EMPTY) contained=flowInto(tiles, visitor, wx, wy-1);
+		else contained=flowInto(tiles, visitor, wx+1, wy)&&flowInto(tiles, visitor, wx-1, wy);
+	}
+	if(!contained)
+		for(unsigned i=0; i<poured.size(); ++i) tiles.set(poured[i].first, poured[i].second, EMPTY);
+}
+
+//Uniform grid over the boxes of cave segments, padded by cave size.
+//Segments that cross have overlapping boxes, so overlap tests only need nearby caves.
+class CaveGrid{
+	public:
+		CaveGrid(unsigned width, unsigned height):
+			//cells get bigger on huge maps, the cave tree doesn't grow with the map
+			cellSize(max(int(MIN_CELL_SIZE), int(max(width, height)/MAX_CELLS_PER_SIDE))),
+			columns(width/cellSize+1), rows(height/cellSize+1),
+			cells(columns*rows), stamp(0)
+		{}
+		void add(unsigned cave, int x1, int y1, int x2, int y2, float pad){
+			int iLo, iHi, jLo, jHi;
+			getCells(x1, y1, x2, y2, pad, iLo, iHi, jLo, jHi);
+			for(int i=iLo; i<=iHi; ++i)
+				for(int j=jLo; j<=jHi; ++j)
+					cells[i*rows+j].push_back(cave);
+			if(cave>=stamps.size()) stamps.resize(cave+1, 0);
+		}
+		//caves whose boxes overlap the given one, each once
+		void query(int x1, int y1, int x2, int y2, float pad, vector<unsigned>& result){
+			result.clear();
+			++stamp;
+			int iLo, iHi, jLo, jHi;
+			getCells(x1, y1, x2, y2, pad, iLo, iHi, jLo, jHi);
+			for(int i=iLo; i<=iHi; ++i)
+				for(int j=jLo; j<=jHi; ++j){
+					const vector<unsigned>& cell=cells[i*rows+j];
+					for(unsigned k=0; k<cell.size(); ++k){
+						if(stamps[cell[k]]==stamp) continue;
+						stamps[cell[k]]=stamp;
+						result.push_back(cell[k]);
+					}
+				}
+		}
+	private:
+		static const int MIN_CELL_SIZE=32;
+		static const unsigned MAX_CELLS_PER_SIDE=256;
+		void getCells(
+			int x1, int y1, int x2, int y2, float pad,
+			int& iLo, int& iHi, int& jLo, int& jHi
+		) const{
+			iLo=clamp(int(floor((min(x1, x2)-pad)/cellSize)), 0, columns-1);
+			iHi=clamp(int(floor((max(x1, x2)+pad)/cellSize)), 0, columns-1);
+			jLo=clamp(int(floor((min(y1, y2)-pad)/cellSize)), 0, rows-1);
+			jHi=clamp(int(floor((max(y1, y2)+pad)/cellSize)), 0, rows-1);
+		}
+		int cellSize, columns, rows;
+		vector<vector<unsigned> > cells;
+		vector<unsigned> stamps;//the last query each cave was found by
+		unsigned stamp;
+};
+
+//Finds the first tile that can be stood on, EMPTY above WALL, among the places asked about.
+//Columns are scanned left to right, or right to left if rightFirst, and each column bottom up.
+//Only the asked about tiles are looked at, so placing something costs the same on any map.
+class StandableQuery{
+	public:
+		StandableQuery(const Tiles& tiles, bool rightFirst):
+			found(false), x(0), y(0), tiles(tiles), rightFirst(rightFirst)
+		{}
+		//tiles less than radius away from x, y along both axes
+		void near(int x, int y, int radius){
+			window(x-radius+1, x+radius-1, y-radius+1, y+radius-1);
+		}
+		bool found;
+		int x, y;
+	private:
+		void window(int xLo, int xHi, int yLo, int yHi){
+			xLo=max(xLo, 0);
+			xHi=min(xHi, int(tiles.readW())-1);
+			yLo=max(yLo, 0);
+			yHi=min(yHi, int(tiles.readH())-1);
+			for(int i=0; i<=xHi-xLo; ++i){
+				int wx=rightFirst?xHi-i:xLo+i;
+				//nothing in this column or past it can beat what's been found
+				if(found&&(rightFirst?wx<x:wx>x)) return;
+				for(int wy=yLo; wy<=yHi; ++wy){
+					if(found&&wx==x&&wy>=y) break;
+					if(tiles.at(wx, wy)==EMPTY&&tiles.at(wx, wy-1)==WALL){
+						found=true;
+						x=wx;
+						y=wy;
+						return;
+					}
+				}
+			}
+		}
+		const Tiles& tiles;
+		bool rightFirst;
+};
+
+//Walks the cave tree from the start cave once, finding
+//-the caves past a hi jump passage, where the buddy can go, and
+//-the dead ends reachable without powerups after passing a platformless cave, for hi jumps.
+//Results are in ascending order.
+void analyzeCaveGraph(
+	unsigned start,
+	const vector<Cave>& caves,
+	vector<unsigned>& initialTerminalCaves,
+	vector<unsigned>& cavesPastHiJumps
+){
+	//adjacency, parent first, then children
+	vector<unsigned> edgeStarts(caves.size()+1, 0);
+	for(unsigned i=0; i<caves.size(); ++i)
+		edgeStarts[i+1]=edgeStarts[i]+1+caves[i].children.size();
+	vector<unsigned> edges(edgeStarts.back());
+	for(unsigned i=0; i<caves.size(); ++i){
+		edges[edgeStarts[i]]=caves[i].parent;
+		for(unsigned j=0; j<caves[i].children.size(); ++j)
+			edges[edgeStarts[i]+1+j]=caves[i].children[j];
+	}
+	//it's a tree, so the path to each cave and the state along it is unique
+	vector<char> visited(caves.size(), 0);
+	vector<char> initiallyReached(caves.size(), 0);
+	vector<char> platformlessPassed(caves.size(), 0);
+	vector<char> hiJumpPassed(caves.size(), 0);
+	vector<unsigned> stack;
+	visited[start]=1;
+	initiallyReached[start]=1;
+	platformlessPassed[start]=!caves[start].platforms;
+	stack.push_back(start);
+	while(stack.size()){
+		unsigned cave=stack.back();
+		stack.pop_back();
+		unsigned bottom=min(caves[cave].yi, caves[cave].yf);
+		for(unsigned e=edgeStarts[cave]; e<edgeStarts[cave+1]; ++e){
+			unsigned nextCave=edges[e];
+			if(visited[nextCave]) continue;
+			visited[nextCave]=1;
+			bool child=e!=edgeStarts[cave];
+			initiallyReached[nextCave]=initiallyReached[cave];
+			hiJumpPassed[nextCave]=hiJumpPassed[cave];
+			if(!caves[cave].platforms&&child){
+				//can't get up to a child that's not at the bottom without powerups
+				if(caves[nextCave].connectionY-2>bottom) initiallyReached[nextCave]=0;
+				//hi jump passages
+				if(caves[nextCave].connectionY-12>bottom) hiJumpPassed[nextCave]=1;
+			}
+			platformlessPassed[nextCave]=platformlessPassed[cave]||!caves[nextCave].platforms;
+			stack.push_back(nextCave);
+		}
+	}
+	for(unsigned i=0; i<caves.size(); ++i){
+		if(initiallyReached[i]&&platformlessPassed[i]&&!caves[i].children.size())
+			initialTerminalCaves.push_back(i);
+		if(hiJumpPassed[i]) cavesPastHiJumps.push_back(i);
+	}
+}
+
+//=====class Tiles=====//
+void Tiles::streamFrom(TileRegions* regions){
+	stream=regions;
+	w=stream->readW();
+	h=stream->readH();
+	chunksH=(h+CHUNK_SIZE-1)/CHUNK_SIZE;
+	vector<unsigned char>().swap(tiles);
+	vector<unsigned char>().swap(mondrian);
+}
+
+void Tiles::keepResident(int xLo, int yLo, int xHi, int yHi){
+	if(stream) stream->keepResident(xLo, yLo, xHi, yHi);
+}
+
+const unsigned char* Tiles::getStreamedChunkTypes(unsigned chunkX, unsigned chunkY) const{
+	return stream->getChunkTypes(chunkX, chunkY);
+}
+
+const unsigned char* Tiles::getStreamedChunkInsets(unsigned chunkX, unsigned chunkY) const{
+	return stream->getChunkInsets(chunkX, chunkY);
+}
+
+//=====class Random=====//
+Random::Random(unsigned seed){
+	//scramble so nearby seeds don't give similar sequences, and xorshift can't start at 0
+	state=seed*2654435761u^0x9e3779b9u;
+	if(!state) state=1;
+	for(unsigned i=0; i<4; ++i) next();
+}
+
+unsigned Random::next(){
+	state^=state<<13;
+	state^=state>>17;
+	state^=state<<5;
+	return state;
+}
+
+float Random::unit(){ return next()/4294967295.0f; }
+
+//=====class GridVisitor=====//
+void GridVisitor::reset(int _xLo, int _yLo, unsigned width, unsigned height){
+	xLo=_xLo;
+	yLo=_yLo;
+	w=width;
+	h=height;
+	bits.assign((w*h+31)/32, 0);
+	pushed.clear();
+	stack.clear();
+}
+
+void GridVisitor::clear(){
+	for(unsigned i=0; i<pushed.size(); ++i) bits[pushed[i]>>5]&=~(1u<<(pushed[i]&31));
+	pushed.clear();
+	stack.clear();
+}
+
+bool GridVisitor::push(int x, int y){
+	if(x<xLo||x>=xLo+int(w)||y<yLo||y>=yLo+int(h)) return false;
+	unsigned i=(y-yLo)*w+x-xLo;
+	if(bits[i>>5]&(1u<<(i&31))) return false;
+	bits[i>>5]|=1u<<(i&31);
+	pushed.push_back(i);
+	stack.push_back(pair<int, int>(x, y));
+	return true;
+}
+
+bool GridVisitor::pop(int& x, int& y){
+	if(stack.empty()) return false;
+	x=stack.back().first;
+	y=stack.back().second;
+	stack.pop_back();
+	return true;
+}
+
+bool GridVisitor::visited(int x, int y) const{
+	if(x<xLo||x>=xLo+int(w)||y<yLo||y>=yLo+int(h)) return false;
+	unsigned i=(y-yLo)*w+x-xLo;
+	return (bits[i>>5]>>(i&31))&1;
+}
+
+//=====struct Cave=====//
+//the columns of row j in the window that the hole at x, y covers, or false if none
+//reach holds a platform hole's half width by distance from its center row
+bool Cave::getSpan(
+	unsigned x, unsigned y, int j, const CarveWindow& window, const vector<int>& reach,
+	int& iLo, int& iHi
+) const{
+	if(j<int(max(y-holeSize, float(window.yLo)))||j>int(min(y+holeSize, window.yHi-1.0f)))
+		return false;
+	iLo=max(x-holeSize, float(window.xLo));
+	iHi=min(x+holeSize, window.xHi-1.0f);
+	if(platforms){
+		unsigned dy=abs(j-int(y));
+		if(dy>=reach.size()) return false;
+		iLo=max(iLo, int(x)-reach[dy]);
+		iHi=min(iHi, int(x)+reach[dy]);
+	}
+	return iLo<=iHi;
+}
+
+void Cave::plan(Random& random){
+	unsigned d=max(abs(int(xf)-int(xi)), abs(int(yf)-int(yi)));
+	platformStep=3+random.next()%2;
+	platformSize=2+random.next()%2;
+	platformSpace=platformSize+1+random.next()%6;
+	platformXOffset=1+random.next()%(platformSpace-1);
+	platformYOffset=random.next()%platformStep;
+	holes.clear();
+	holeSize=size;
+	if(d==0) holeSize*=1+random.unit();
+	for(unsigned i=0; i<=d; ++i){
+		unsigned x=xi, y=yi;
+		if(d){
+			x=linear(xi, xf, 1.0f*i/d);
+			y=linear(yi, yf, 1.0f*i/d);
+		}
+		x+=holeSize/4*(random.unit()-0.5f);
+		y+=holeSize/4*(random.unit()-0.5f);
+		holes.push_back(std::pair<unsigned, unsigned>(x, y));
+	}
+}
+
+void Cave::implement(Tiles& tiles, const CarveWindow& window) const{
+	//Carving a tile again changes nothing, so each hole only carves what the previous hole
+	//didn't cover. Consecutive holes overlap almost entirely, so this costs about the
+	//cave's area rather than its length times the area of a hole.
+	vector<int> reach;
+	if(platforms)
+		//widest k with k*k+dy*dy<holeSize*holeSize, compared as a disc test would
+		for(unsigned dy=0; dy*dy<holeSize*holeSize; ++dy){
+			int k=int(sqrt(holeSize*holeSize-dy*dy));
+			while(k>0&&!(unsigned(k*k)+dy*dy<holeSize*holeSize)) --k;
+			while(unsigned((k+1)*(k+1))+dy*dy<holeSize*holeSize) ++k;
+			reach.push_back(k);
+		}
+	for(unsigned h=0; h<holes.size(); ++h){
+		unsigned x=holes[h].first, y=holes[h].second;
+		if(x+holeSize<window.xLo||x-holeSize>=window.xHi) continue;
+		if(y+holeSize<window.yLo||y-holeSize>=window.yHi) continue;
+		for(int j=max(y-holeSize, float(window.yLo)); j<=min(y+holeSize, window.yHi-1.0f); ++j){
+			int iLo, iHi;
+			if(!getSpan(x, y, j, window, reach, iLo, iHi)) continue;
+			int doneLo, doneHi;//covered by the previous hole
+			if(!h||!getSpan(holes[h-1].first, holes[h-1].second, j, window, reach, doneLo, doneHi)){
+				doneLo=iHi+1;
+				doneHi=iHi;
+			}
+			for(int i=iLo; i<=min(iHi, doneLo-1); ++i) carve(i, j, tiles, window);
+			for(int i=max(iLo, doneHi+1); i<=iHi; ++i) carve(i, j, tiles, window);
+		}
+	}
+}
+
+void Cave::carve(int i, int j, Tiles& tiles, const CarveWindow& window) const{
+	int x=i-window.originX, y=j-window.originY;
+	if(!platforms){
+		tiles.set(x, y, STAY_EMPTY);
+		return;
+	}
+	bool isPlatform=false;
+	int platformI=i+platformXOffset*j/platformStep;
+	if((j+platformI/platformSpace*platformYOffset)%platformStep==0)
+		if(platformI%platformSpace<platformSize)
+			isPlatform=true;
+	if(isPlatform){
+		if(tiles.at(x, y)!=STAY_EMPTY)
+			tiles.set(x, y, WALL);
+	}
+	else tiles.set(x, y, EMPTY);
+}
+
+bool Cave::addBranch(
+	unsigned& x, unsigned& y, Random& random, unsigned maxBranches, unsigned tries
+){
+	if(branches.size()>=maxBranches) return false;
+	for(unsigned i=0; i<tries; ++i){
+		float t=random.unit();
+		bool good=true;
+		for(unsigned j=0; j<branches.size(); ++j)
+			if(abs(t-branches[j])<0.2f){
+				good=false;
+				break;
+			}
+		if(!good) continue;
+		branches.push_back(t);
+		x=linear(xi, xf, t);
+		y=linear(yi, yf, t);
+		return true;
+	}
+	return false;
+}
+
+//=====class World=====//
+class CarveJob: public Job{
+	public:
+		CarveJob(const vector<Cave>& caves, Tiles& tiles, const CarveWindow& window):
+			caves(caves), tiles(tiles), window(window)
+		{}
+		void run(){
+			for(unsigned i=0; i<caves.size(); ++i) caves[i].implement(tiles, window);
+		}
+	private:
+		const vector<Cave>& caves;
+		Tiles& tiles;
+		CarveWindow window;
+};
+
+
+void World::generate(
+	unsigned _seed, unsigned width, unsigned height,
+	PhaseTimer* timer, ThreadPool* pool
+){
+	//initialize
+	seed=_seed;
+	Random random(seed);
+	tiles.resize(width, height);
+	caves.clear();
+	playerX=playerY=buddyX=buddyY=scubaX=scubaY=0;
+	hiJumps.clear();
+	if(timer) timer->start();
+	//MONDRIANIZE ME CAPTAIN
+	layMondrianLines(tiles, random, tiles.readW());
+	tiles.setMondrianL(0, 0, 0.0f);
+	tiles.setMondrianR(0, 0, 0.0f);
+	tiles.setMondrianU(0, 0, 0.0f);
+	tiles.setMondrianD(0, 0, 0.0f);
+	if(timer) timer->phase("mondrian");
+	growCaves(random, width, height);
+	if(timer) timer->phase("cave tree");
+	for(unsigned i=0; i<caves.size(); ++i) caves[i].plan(random);
+	//each job carves every cave in order, but only within its own columns, so
+	//overlapping caves settle the same way however the jobs are scheduled
+	if(pool){
+		vector<Job*> jobs;
+		int stripe=(tiles.readW()/(pool->readThreads()*4)+CHUNK_SIZE-1)/CHUNK_SIZE*CHUNK_SIZE;
+		stripe=max(stripe, CHUNK_SIZE);
+		for(int x=0; x<int(tiles.readW()); x+=stripe)
+			jobs.push_back(new CarveJob(
+				caves, tiles,
+				CarveWindow(x, 0, min(x+stripe, int(tiles.readW())), tiles.readH())
+			));
+		pool->run(jobs);
+		for(unsigned i=0; i<jobs.size(); ++i) delete jobs[i];
+	}
+	else
+		for(unsigned i=0; i<caves.size(); ++i)
+			caves[i].implement(tiles, CarveWindow(0, 0, tiles.readW(), tiles.readH()));
+	if(timer) timer->phase("cave implement");
+	replaceTiles(tiles, STAY_EMPTY, EMPTY);
+	removeDiagonals(tiles);
+	if(timer) timer->phase("cleanup");
+	//add water on the right half
+	GridVisitor visitor;
+	visitor.reset(tiles.readW(), tiles.readH());
+	bool waterPlaced=false;
+	for(int y=tiles.readH()-1; y>=0; --y)
+		for(int x=tiles.readW()-1; x>tiles.readW()/2; --x){
+			bool goodPlace=false;
+			for(unsigned i=0; i<caves.size(); ++i){
+				int midX=(caves[i].xi+caves[i].xf)/2;
+				int midY=(caves[i].yi+caves[i].yf)/2;
+				if(x==midX&&abs(y-midY)<6) goodPlace=true;
+			}
+			if(!goodPlace) continue;
+			if(
+				tiles.at(x, y)==EMPTY
+				&&
+				tiles.at(x, y+1)==WALL
+			){
+				if(waterPlaced){ if(random.next()%2) continue; }
+				else waterPlaced=true;
+				visitor.clear();
+				pourWater(tiles, visitor, x, y);
+			}
+		}
+	if(timer) timer->phase("water");
+	placeThings(timer, max(width, height));
+}
+
+//grows the cave tree from a random root, without carving anything
+void World::growCaves(Random& random, unsigned width, unsigned height){
+	const unsigned firstSize=5;
+	const unsigned firstHeight=random.next()%(height/2)+height/4+firstSize+1;
+	caves.push_back(Cave(
+		random.next()%(width/4)+firstSize+1,
+		firstHeight,
+		random.next()%(width/4)+width/2-firstSize-1,
+		firstHeight+random.next()%(height/4)-height/8,
+		firstSize,
+		true,
+		0
+	));
+	caves.back().parent=0;
+	caves.back().connectionY=0;
+	caveRejections=0;
+	const CaveTreeSettings& settings=caveTreeSettings;
+	CaveGrid grid(width, height);
+	grid.add(0, caves[0].xi, caves[0].yi, caves[0].xf, caves[0].yf, caves[0].size);
+	vector<unsigned> nearby;
+	vector<unsigned> queue;
+	queue.push_back(0);
+	bool madePlatformlessCave=false;
+	while(queue.size()){
+		//pick a parent
+		unsigned i=random.next()%queue.size();
+		//choose whether or not child has platforms
+		bool platforms=random.next()%8;
+		if(!madePlatformlessCave) platforms=false;
+		//get location and size
+		unsigned x, y;
+		float size=caves[queue[i]].size/1.25f;
+		bool branches=caves[queue[i]].depth<=settings.maxDepth&&size>=2.0f;
+		if(
+			branches
+			&&
+			!caves[queue[i]].addBranch(x, y, random, settings.maxBranches, settings.branchTries)
+		){
+			//ran out of tries rather than branches
+			if(caves[queue[i]].branches.size()<settings.maxBranches) ++caveRejections;
+			branches=false;
+		}
+		if(!branches){
+			queue.erase(queue.begin()+i);
+			continue;
+		}
+		//get perpendicular direction
+		int dx=int(caves[queue[i]].yi)-int(caves[queue[i]].yf);
+		int dy=int(caves[queue[i]].xf)-int(caves[queue[i]].xi);
+		if(platforms){
+			//maybe flip it
+			if(random.next()%2){
+				dx=-dx;
+				dy=-dy;
+			}
+		}
+		else{
+			//force it to be upward
+			if(dy<0) dy=-dy;
+			if(dy>32) dy=32;
+			dx=0;
+		}
+		//change length
+		dx*=0.5f*random.unit()+1.0f;
+		dy*=0.5f*random.unit()+1.0f;
+		//noise
+		if(platforms){
+			float r=sqrt(dx*dx+dy*dy);
+			dx+=r*(0.5f*random.unit()-0.25f);
+			dy+=r*(0.5f*random.unit()-0.25f);
+		}
+		//limit
+		const int extra=4;
+		dx=min(dx, int(width-size-extra-x));
+		dx=max(dx, int(size+extra-x));
+		dy=min(dy, int(height-size-extra-y));
+		dy=max(dy, int(size+extra-y));
+		//check if it overlaps with other caves
+		bool overlaps=false;
+		grid.query(x, y, x+dx, y+dy, size, nearby);
+		for(unsigned j=0; j<nearby.size(); ++j){
+			const Cave& cave=caves[nearby[j]];
+			int dx2=int(cave.xf)-int(cave.xi);
+			int dy2=int(cave.yf)-int(cave.yi);
+			if(intersects(
+				x, y,
+				dx, dy,
+				cave.xi, cave.yi,
+				dx2, dy2,
+				(cave.size+size)/(abs(dx)+abs(dy)),
+				(cave.size+size)/(abs(dx2)+abs(dy2))
+			)){
+				overlaps=true;
+				break;
+			}
+		}
+		if(overlaps){
+			++caveRejections;
+			continue;
+		}
+		//stick it in
+		if(!platforms) madePlatformlessCave=true;
+		caves.push_back(Cave(
+			x,
+			y,
+			clamp(int(x)+dx, 0, width-1),
+			clamp(int(y)+dy, 0, height-1),
+			size,
+			platforms,
+			caves[queue[i]].depth+1
+		));
+		grid.add(
+			unsigned(caves.size()-1),
+			caves.back().xi, caves.back().yi, caves.back().xf, caves.back().yf,
+			size
+		);
+		queue.push_back(unsigned(caves.size()-1));
+		//attach
+		caves[queue[i]].children.push_back((unsigned)caves.size()-1);
+		caves.back().parent=queue[i];
+		caves.back().connectionY=y;
+	}
+}
+
+//places the player, scuba, buddy and hi jumps on the carved tiles
+//the scuba suit is only looked for within scubaRange of the player along both axes
+void World::placeThings(PhaseTimer* timer, int scubaRange){
+	//set the player's position to somewhere on the left
+	int desiredX=tiles.readW(), desiredY;
+	for(unsigned i=0; i<caves.size(); ++i)
+		if(caves[i].platforms){
+			if(caves[i].xi<desiredX){
+				playerCave=i;
+				desiredX=caves[i].xi;
+				desiredY=caves[i].yi;
+			}
+			if(caves[i].xf<desiredX){
+				playerCave=i;
+				desiredX=caves[i].xf;
+				desiredY=caves[i].yf;
+			}
+		}
+	StandableQuery player(tiles, false);
+	player.near(desiredX, desiredY, 8);
+	if(player.found){
+		playerX=player.x;
+		playerY=player.y;
+	}
+	if(timer) timer->phase("player");
+	//add scuba suit somewhere accessible to the player
+	//the furthest potential spot wins, ties going to the lowest x, then the lowest y
+	GridVisitor visitor;
+	int scubaXLo=max(playerX-scubaRange, 0), scubaYLo=max(playerY-scubaRange, 0);
+	visitor.reset(
+		scubaXLo, scubaYLo,
+		min(playerX+scubaRange+1, int(tiles.readW()))-scubaXLo,
+		min(playerY+scubaRange+1, int(tiles.readH()))-scubaYLo
+	);
+	visitor.push(playerX, playerY);
+	float furthest=0.0f;
+	int x, y;
+	while(visitor.pop(x, y)){
+		if(x>tiles.readW()/3) continue;
+		if(tiles.at(x-1, y)==EMPTY||tiles.at(x+1, y)==EMPTY){
+			float distance=abs(x-playerX)+abs(y-playerY);
+			if(
+				distance>furthest
+				||
+				(distance==furthest&&furthest>0.0f&&pair<int, int>(x, y)<pair<int, int>(scubaX, scubaY))
+			){
+				scubaX=x;
+				scubaY=y;
+				furthest=distance;
+			}
+		}
+		if(tiles.at(x+1, y)==EMPTY) visitor.push(x+1, y);
+		if(tiles.at(x-1, y)==EMPTY) visitor.push(x-1, y);
+		if(tiles.at(x, y-1)==EMPTY) visitor.push(x, y-1);
+	}
+	if(timer) timer->phase("scuba");
+	//set the buddy position to somewhere past a hi jump, prefer being on the right
+	vector<unsigned> initiallyTerminalCaves, cavesPastHiJumps;
+	analyzeCaveGraph(playerCave, caves, initiallyTerminalCaves, cavesPastHiJumps);
+	//with none past a hi jump any cave will do, the buddy is still only looked for near cave
+	//ends so a streamed or lazy level isn't read all over to place it
+	vector<unsigned> buddyCaves=cavesPastHiJumps;
+	if(buddyCaves.empty())
+		for(unsigned i=0; i<caves.size(); ++i) buddyCaves.push_back(i);
+	StandableQuery buddy(tiles, true);
+	//rightmost first, so once a spot is found most of the rest are ruled out without a look
+	vector<pair<int, int> > ends;
+	for(unsigned i=0; i<buddyCaves.size(); ++i){
+		const Cave& cave=caves[buddyCaves[i]];
+		ends.push_back(pair<int, int>(cave.xi, cave.yi));
+		ends.push_back(pair<int, int>(cave.xf, cave.yf));
+	}
+	sort(ends.rbegin(), ends.rend());
+	for(unsigned i=0; i<ends.size(); ++i) buddy.near(ends[i].first, ends[i].second, 8);
+	if(buddy.found){
+		buddyX=buddy.x;
+		buddyY=buddy.y;
+	}
+	if(timer) timer->phase("buddy");
+	//set the hi jump location to somewhere accessible with no powerups from start
+	for(unsigned i=0; i<initiallyTerminalCaves.size(); ++i){
+		const Cave& cave=caves[initiallyTerminalCaves[i]];
+		pair<int, int> hiJump(0, 0);
+		if(!cave.platforms)
+			hiJump=pair<int, int>(cave.xi, cave.yi);
+		else{
+			StandableQuery standable(tiles, false);
+			standable.near(cave.xf, cave.yf, 4);
+			if(standable.found) hiJump=pair<int, int>(standable.x, standable.y);
+		}
+		hiJumps.push_back(hiJump);
+	}
+	if(timer) timer->phase("hi jumps");
+}
+
+void World::generateLazily(
+	unsigned _seed, unsigned width, unsigned height,
+	TileGenerator& generator, PhaseTimer* timer
+){
+	//initialize
+	seed=_seed;
+	Random random(seed);
+	tiles=Tiles();
+	caves.clear();
+	playerX=playerY=buddyX=buddyY=scubaX=scubaY=0;
+	hiJumps.clear();
+	if(timer) timer->start();
+	growCaves(random, width, height);
+	if(timer) timer->phase("cave tree");
+	for(unsigned i=0; i<caves.size(); ++i) caves[i].plan(random);
+	if(timer) timer->phase("cave plan");
+	generator.start(*this, width, height);
+	tiles.streamFrom(&generator);
+	//the scuba search would otherwise generate most of the left of the map
+	placeThings(timer, REGION_TILES/2);
+}
+
+void World::generateRegion(
+	unsigned regionX, unsigned regionY, unsigned width, unsigned height,
+	vector<unsigned char>& bytes
+) const{
+	//Pools are only kept if they stay within WATER_REACH of where they're poured, and are
+	//poured from up to WATER_REACH past the region, so caves are carved that much further.
+	//Cleanup looks at neighbouring tiles, so they're carved a bit further still.
+	const int WATER_REACH=4*CHUNK_SIZE;
+	const int MARGIN=2*WATER_REACH+CHUNK_SIZE;
+	int xi=regionX*REGION_TILES, yi=regionY*REGION_TILES;
+	int regionW=min(REGION_TILES, width-xi), regionH=min(REGION_TILES, height-yi);
+	Random random(seed^(regionX*0x9e3779b1u)^(regionY*0x85ebca77u));
+	//mondrian lines, stopping at the edges of the region like they do at the edges of a map
+	Tiles insets;
+	insets.resize(regionW, regionH);
+	layMondrianLines(insets, random, regionW);
+	//caves, with tile 0, 0 of types being MARGIN tiles down and left of the region
+	Tiles types;
+	types.resize(regionW+2*MARGIN, regionH+2*MARGIN);
+	CarveWindow window(
+		max(xi-MARGIN, 0), max(yi-MARGIN, 0),
+		min(xi+regionW+MARGIN, int(width)), min(yi+regionH+MARGIN, int(height)),
+		xi-MARGIN, yi-MARGIN
+	);
+	for(unsigned i=0; i<caves.size(); ++i) caves[i].implement(types, window);
+	replaceTiles(types, STAY_EMPTY, EMPTY);
+	removeDiagonals(types);
+	//Water on the right half, from every cave in reach of the region, each pool kept to a
+	//box around where it's poured. A pool across a seam then comes out the same in the
+	//regions on both sides of it, instead of stopping at the seam in a wall of water.
+	//Whether a spot gets water depends only on the seed, cave and height, not on the region.
+	int wxLo=max(xi-WATER_REACH, 0), wyLo=max(yi-WATER_REACH, 0);
+	int wxHi=min(xi+regionW+WATER_REACH, int(width)), wyHi=min(yi+regionH+WATER_REACH, int(height));
+	GridVisitor visitor;
+	for(unsigned i=0; i<caves.size(); ++i){
+		int midX=(caves[i].xi+caves[i].xf)/2;
+		int midY=(caves[i].yi+caves[i].yf)/2;
+		if(midX<=int(width/2)||midX<wxLo||midX>=wxHi) continue;
+		for(int y=min(midY+5, wyHi-1); y>=max(midY-5, wyLo); --y){
+			int x=midX-xi+MARGIN, ty=y-yi+MARGIN;
+			if(types.at(x, ty)!=EMPTY||types.at(x, ty+1)!=WALL) continue;
+			if(Random(seed^(i*0x9e3779b1u)^(y*0x85ebca77u)).next()%2) continue;
+			visitor.reset(x-WATER_REACH, ty-WATER_REACH, 2*WATER_REACH+1, 2*WATER_REACH+1);
+			pourWater(types, visitor, x, ty);
+		}
+	}
+	//chunks past the edge of the map are left as WALL
+	bytes.assign(REGION_BYTES, 0);
+	fill(bytes.begin(), bytes.begin()+REGION_TYPE_BYTES, WALL|WALL<<2|WALL<<4|WALL<<6);
+	for(int i=0; i*CHUNK_SIZE<regionW; ++i)
+		for(int j=0; j*CHUNK_SIZE<regionH; ++j){
+			unsigned chunk=i*REGION_CHUNKS+j;
+			const unsigned char* chunkTypes=
+				types.readChunkTypes(i+MARGIN/CHUNK_SIZE, j+MARGIN/CHUNK_SIZE);
+			const unsigned char* chunkInsets=insets.readChunkInsets(i, j);
+			copy(chunkTypes, chunkTypes+CHUNK_TYPE_BYTES, bytes.begin()+chunk*CHUNK_TYPE_BYTES);
+			copy(
+				chunkInsets, chunkInsets+CHUNK_INSET_BYTES,
+				bytes.begin()+REGION_TYPE_BYTES+chunk*CHUNK_INSET_BYTES
+			);
+		}
+}
+
+//=====batches=====//
+class WorldJob: public Job{
+	public:
+		WorldJob(World& world, unsigned seed, unsigned width, unsigned height):
+			world(world), seed(seed), width(width), height(height)
+		{}
+		void run(){ world.generate(seed, width, height); }
+	private:
+		World& world;
+		unsigned seed, width, height;
+};
+
+void generateWorlds(
+	vector<World>& worlds, const vector<unsigned>& seeds,
+	unsigned width, unsigned height, ThreadPool& pool
+){
+	worlds.resize(seeds.size());
+	vector<Job*> jobs;
+	for(unsigned i=0; i<seeds.size(); ++i)
+		jobs.push_back(new WorldJob(worlds[i], seeds[i], width, height));
+	pool.run(jobs);
+	for(unsigned i=0; i<jobs.size(); ++i) delete jobs[i];
+}
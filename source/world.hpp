@@ -0,0 +1,265 @@
+#ifndef WORLD_HPP_INCLUDED
+#define WORLD_HPP_INCLUDED
+
+#include "threadPool.hpp"
+
+#include <vector>
+#include <utility>
+#include <cstdlib>
+#include <algorithm>
+
+const int CHUNK_SIZE=16;//tiles per side of a chunk
+//bump whenever a seed would generate a different world, so that cached worlds are regenerated
+const unsigned GENERATOR_VERSION=1;
+
+enum Tile{ EMPTY, WALL, STAY_EMPTY, WATER };
+
+const unsigned CHUNK_TYPE_BYTES=CHUNK_SIZE*CHUNK_SIZE/4;
+const unsigned CHUNK_INSET_BYTES=CHUNK_SIZE*CHUNK_SIZE*4;
+
+class TileRegions;
+class TileGenerator;
+
+//Tiles are stored in CHUNK_SIZE by CHUNK_SIZE chunks, column-major both between and within chunks.
+//A chunk's tile types are packed 2 bits each, so they fit in one 64 byte cache line.
+//Mondrian insets are quantized to bytes and kept apart from the types, LRUD per tile.
+//Tiles can also be streamed a region at a time instead, from a world file or generated as
+//they're needed, see TileRegions. Those are read only, and the regions must outlive every
+//copy of the tiles.
+class Tiles{
+	public:
+		Tiles(): w(0), h(0), chunksH(0), stream(NULL) {}
+		void resize(unsigned width, unsigned height){
+			w=width;
+			h=height;
+			chunksH=(height+CHUNK_SIZE-1)/CHUNK_SIZE;
+			stream=NULL;
+			unsigned chunks=(width+CHUNK_SIZE-1)/CHUNK_SIZE*chunksH;
+			tiles.assign(chunks*CHUNK_TYPE_BYTES, (unsigned char)WALL_BYTE);
+			mondrian.assign(chunks*CHUNK_INSET_BYTES, 0);
+		}
+		void streamFrom(TileRegions* regions);
+		bool isStreamed() const{ return stream!=NULL; }
+		//Streamed tiles away from this window, in tiles, may be dropped from memory.
+		//Does nothing for tiles that aren't streamed.
+		void keepResident(int xLo, int yLo, int xHi, int yHi);
+		Tile at(int x, int y) const{
+			if(x<0||x>=int(w)||y<0||y>=int(h)) return WALL;
+			unsigned i=tileIndex(x, y);
+			return Tile((readChunkTypes(x/CHUNK_SIZE, y/CHUNK_SIZE)[i>>2]>>((i&3)<<1))&3);
+		}
+		float mondrianLAt(int x, int y) const{ return mondrianAt(x, y, 0); }
+		float mondrianRAt(int x, int y) const{ return mondrianAt(x, y, 1); }
+		float mondrianUAt(int x, int y) const{ return mondrianAt(x, y, 2); }
+		float mondrianDAt(int x, int y) const{ return mondrianAt(x, y, 3); }
+		void setMondrianL(int x, int y, float size){ setMondrian(x, y, 0, size); }
+		void setMondrianR(int x, int y, float size){ setMondrian(x, y, 1, size); }
+		void setMondrianU(int x, int y, float size){ setMondrian(x, y, 2, size); }
+		void setMondrianD(int x, int y, float size){ setMondrian(x, y, 3, size); }
+		void set(int x, int y, Tile tile){
+			if(x<0||x>=int(w)||y<0||y>=int(h)||stream) return;
+			unsigned i=tileIndex(x, y);
+			unsigned char& byte=tiles[chunkIndex(x/CHUNK_SIZE, y/CHUNK_SIZE)*CHUNK_TYPE_BYTES+(i>>2)];
+			byte=(byte&~(3<<((i&3)<<1)))|(tile<<((i&3)<<1));
+		}
+		unsigned readW() const{ return w; }
+		unsigned readH() const{ return h; }
+		unsigned readChunksH() const{ return chunksH; }
+		//a chunk's storage, CHUNK_TYPE_BYTES of types and CHUNK_INSET_BYTES of insets
+		const unsigned char* readChunkTypes(unsigned chunkX, unsigned chunkY) const{
+			if(stream) return getStreamedChunkTypes(chunkX, chunkY);
+			return &tiles[chunkIndex(chunkX, chunkY)*CHUNK_TYPE_BYTES];
+		}
+		const unsigned char* readChunkInsets(unsigned chunkX, unsigned chunkY) const{
+			if(stream) return getStreamedChunkInsets(chunkX, chunkY);
+			return &mondrian[chunkIndex(chunkX, chunkY)*CHUNK_INSET_BYTES];
+		}
+		void writeChunk(
+			unsigned chunkX, unsigned chunkY, const unsigned char* types, const unsigned char* insets
+		){
+			if(stream) return;
+			unsigned chunk=chunkIndex(chunkX, chunkY);
+			std::copy(types, types+CHUNK_TYPE_BYTES, tiles.begin()+chunk*CHUNK_TYPE_BYTES);
+			std::copy(insets, insets+CHUNK_INSET_BYTES, mondrian.begin()+chunk*CHUNK_INSET_BYTES);
+		}
+		//Raw storage for whole-grid kernels. The column of chunk tiles above x, chunkY*CHUNK_SIZE
+		//is one word with 2 bits per tile, bottom tile in the low bits. Tiles past the edge are WALL.
+		unsigned readChunkColumn(unsigned x, unsigned chunkY) const{
+			const unsigned char* bytes=readChunkTypes(x/CHUNK_SIZE, chunkY)+x%CHUNK_SIZE*4;
+			return bytes[0]|bytes[1]<<8|bytes[2]<<16|unsigned(bytes[3])<<24;
+		}
+		void writeChunkColumn(unsigned x, unsigned chunkY, unsigned word){
+			if(stream) return;
+			unsigned char* bytes=&tiles[chunkIndex(x/CHUNK_SIZE, chunkY)*CHUNK_TYPE_BYTES+x%CHUNK_SIZE*4];
+			for(unsigned i=0; i<4; ++i) bytes[i]=word>>(i*8);
+		}
+	private:
+		static const unsigned char WALL_BYTE=WALL|WALL<<2|WALL<<4|WALL<<6;
+		unsigned chunkIndex(unsigned chunkX, unsigned chunkY) const{ return chunkX*chunksH+chunkY; }
+		static unsigned tileIndex(unsigned x, unsigned y){
+			return x%CHUNK_SIZE*CHUNK_SIZE+y%CHUNK_SIZE;
+		}
+		const unsigned char* getStreamedChunkTypes(unsigned chunkX, unsigned chunkY) const;
+		const unsigned char* getStreamedChunkInsets(unsigned chunkX, unsigned chunkY) const;
+		float mondrianAt(int x, int y, unsigned side) const{
+			if(x<0||x>=int(w)||y<0||y>=int(h)) return 0.0f;
+			return readChunkInsets(x/CHUNK_SIZE, y/CHUNK_SIZE)[tileIndex(x, y)*4+side]/255.0f;
+		}
+		void setMondrian(int x, int y, unsigned side, float size){
+			if(x<0||x>=int(w)||y<0||y>=int(h)||stream) return;
+			int quantized=int(size*255+0.5f);
+			if(quantized<1&&size>0.0f) quantized=1;//nonzero insets must stay nonzero
+			if(quantized>255) quantized=255;
+			mondrian[chunkIndex(x/CHUNK_SIZE, y/CHUNK_SIZE)*CHUNK_INSET_BYTES+tileIndex(x, y)*4+side]=quantized;
+		}
+		std::vector<unsigned char> tiles;
+		std::vector<unsigned char> mondrian;
+		unsigned w, h, chunksH;
+		TileRegions* stream;
+};
+
+//xorshift, so that each world has its own reproducible sequence instead of sharing rand()'s
+class Random{
+	public:
+		Random(unsigned seed=1);
+		unsigned next();
+		float unit();//0 to 1 inclusive
+	private:
+		unsigned state;
+};
+
+//bookkeeping for flood fills over the tiles, a visited bit per tile and a flat stack
+//reset keeps the memory, so one visitor can be reused for every fill
+class GridVisitor{
+	public:
+		void reset(unsigned width, unsigned height){ reset(0, 0, width, height); }
+		//only tiles in the window starting at xLo, yLo can be pushed
+		void reset(int xLo, int yLo, unsigned width, unsigned height);
+		//forgets the tiles pushed since the last reset or clear, touching only those
+		void clear();
+		//pushes x, y unless it's out of bounds or was already pushed since the reset
+		bool push(int x, int y);
+		bool pop(int& x, int& y);
+		bool visited(int x, int y) const;
+	private:
+		std::vector<unsigned> bits;
+		std::vector<unsigned> pushed;//bit indices, for clear
+		std::vector<std::pair<int, int> > stack;
+		int xLo, yLo;
+		unsigned w, h;
+};
+
+//The part of the world being carved, in world tiles, with xHi and yHi just past it.
+//The tiles being carved into start at originX, originY, so they can hold just a part.
+struct CarveWindow{
+	CarveWindow(int xLo, int yLo, int xHi, int yHi, int originX=0, int originY=0):
+		xLo(xLo), yLo(yLo), xHi(xHi), yHi(yHi), originX(originX), originY(originY)
+	{}
+	int xLo, yLo, xHi, yHi;
+	int originX, originY;
+};
+
+struct Cave{
+	Cave(
+		unsigned xi, unsigned yi, unsigned xf, unsigned yf,
+		float size, bool platforms, int depth
+	):
+		xi(xi), yi(yi), xf(xf), yf(yf),
+		size(size), platforms(platforms), depth(depth), parent(0), connectionY(0),
+		holeSize(size), platformStep(1), platformSize(0), platformSpace(1),
+		platformXOffset(0), platformYOffset(0)
+	{}
+	
+	//draws everything random up front, so that carving can be split between threads
+	void plan(Random& random);
+	//carves the planned holes, only touching tiles in the window
+	void implement(Tiles& tiles, const CarveWindow&) const;
+	bool getSpan(
+		unsigned x, unsigned y, int j, const CarveWindow&, const std::vector<int>& reach,
+		int& iLo, int& iHi
+	) const;
+	void carve(int i, int j, Tiles& tiles, const CarveWindow&) const;
+	//false if the cave has maxBranches already or no spot was found in tries attempts
+	bool addBranch(
+		unsigned& x, unsigned& y, Random& random, unsigned maxBranches, unsigned tries
+	);
+	
+	unsigned xi, yi, xf, yf;
+	float size;
+	bool platforms;
+	std::vector<float> branches;
+	int depth;
+	std::vector<unsigned> children;
+	unsigned parent;
+	unsigned connectionY;
+	std::vector<std::pair<unsigned, unsigned> > holes;
+	//set by plan, until then a plain hole of size and no platforms
+	float holeSize;
+	int platformStep, platformSize, platformSpace, platformXOffset, platformYOffset;
+};
+
+//how cave trees grow, the defaults are what the game has always used
+struct CaveTreeSettings{
+	CaveTreeSettings(): maxDepth(3), maxBranches(3), branchTries(100) {}
+	int maxDepth;//caves deeper than this don't branch
+	unsigned maxBranches;//per cave
+	//Random spots tried for a branch before giving up on a cave. Branches must be
+	//spaced apart along their parent, so this bounds the search once a cave is crowded.
+	unsigned branchTries;
+};
+
+//told when each phase of world generation finishes, for profiling
+class PhaseTimer{
+	public:
+		virtual ~PhaseTimer(){}
+		virtual void start()=0;
+		virtual void phase(const char* name)=0;
+};
+
+//everything world generation produces; positions are in tiles
+//generation only touches the World and its own Random, so several can run at once
+class World{
+	public:
+		//the pool is only for carving caves, so don't pass one when the world
+		//is itself being generated as one of a pool's jobs
+		void generate(
+			unsigned seed, unsigned width, unsigned height,
+			PhaseTimer* timer=NULL, ThreadPool* pool=NULL
+		);
+		//Only grows the cave tree and places things, the tiles are generated a region at a
+		//time by the generator as they're needed, so starting costs the same on any map.
+		//Each region's mondrian lines are its own and don't cross into the next. Water pools
+		//do, but only ones that stay near where they're poured, so there's less water.
+		//It's a different world than generate makes for the same seed.
+		void generateLazily(
+			unsigned seed, unsigned width, unsigned height,
+			TileGenerator& generator, PhaseTimer* timer=NULL
+		);
+		//Fills bytes with the region as TileStream lays it out, for a world from generateLazily.
+		//It only reads the caves and seed, so it can run on any thread.
+		void generateRegion(
+			unsigned regionX, unsigned regionY, unsigned width, unsigned height,
+			std::vector<unsigned char>& bytes
+		) const;
+		CaveTreeSettings caveTreeSettings;
+		Tiles tiles;
+		int playerX, playerY;
+		int buddyX, buddyY;
+		int scubaX, scubaY;
+		std::vector<std::pair<int, int> > hiJumps;
+		//these are members just because it's easier to debug this way
+		unsigned playerCave;
+		std::vector<Cave> caves;
+		unsigned caveRejections;//branches given up on because of overlaps or crowding
+		unsigned seed;
+	private:
+		void growCaves(Random&, unsigned width, unsigned height);
+		void placeThings(PhaseTimer*, int scubaRange);
+};
+
+void generateWorlds(
+	std::vector<World>& worlds, const std::vector<unsigned>& seeds,
+	unsigned width, unsigned height, ThreadPool& pool
+);
+
+#endif
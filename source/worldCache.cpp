@@ -0,0 +1,292 @@
+#include "worldCache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+//=====helpers=====//
+const unsigned MAGIC=0x444c5257;//"WRLD"
+const unsigned FORMAT_VERSION=2;
+
+class Writer{
+	public:
+		void put(unsigned u){
+			for(unsigned i=0; i<4; ++i) bytes.push_back((u>>(8*i))&0xff);
+		}
+		void put(int i){ put(unsigned(i)); }
+		void put(float f){
+			unsigned u;
+			memcpy(&u, &f, sizeof(u));
+			put(u);
+		}
+		void putAt(unsigned at, unsigned u){
+			for(unsigned i=0; i<4; ++i) bytes[at+i]=(u>>(8*i))&0xff;
+		}
+		vector<unsigned char> bytes;
+};
+
+//reads from a buffer, failing instead of reading past its end
+class Reader{
+	public:
+		Reader(const unsigned char* data, unsigned size): data(data), size(size), at(0) {}
+		bool get(unsigned& u){
+			if(size-at<4) return false;
+			u=data[at]|data[at+1]<<8|data[at+2]<<16|unsigned(data[at+3])<<24;
+			at+=4;
+			return true;
+		}
+		bool get(int& i){
+			unsigned u;
+			if(!get(u)) return false;
+			i=int(u);
+			return true;
+		}
+		bool get(float& f){
+			unsigned u;
+			if(!get(u)) return false;
+			memcpy(&f, &u, sizeof(f));
+			return true;
+		}
+	private:
+		const unsigned char* data;
+		unsigned size, at;
+};
+
+//Renames from to to, replacing it. POSIX rename replaces atomically, but on Windows it fails
+//if to exists, so only there is to removed first, and only if it's in the way.
+static bool replaceFile(const string& from, const string& to){
+	if(rename(from.c_str(), to.c_str())==0) return true;
+#ifdef _WIN32
+	remove(to.c_str());
+	return rename(from.c_str(), to.c_str())==0;
+#else
+	return false;
+#endif
+}
+
+//=====functions=====//
+string getWorldCacheFileName(
+	const string& directory, unsigned seed, unsigned width, unsigned height
+){
+	stringstream ss;
+	ss<<directory<<"world-"<<seed<<"-"<<width<<"x"<<height<<"-v"<<GENERATOR_VERSION<<".bin";
+	return ss.str();
+}
+
+bool saveWorld(const World& world, const string& fileName){
+	Writer writer;
+	const Tiles& tiles=world.tiles;
+	writer.put(MAGIC);
+	writer.put(FORMAT_VERSION);
+	writer.put(GENERATOR_VERSION);
+	writer.put(world.seed);
+	writer.put(tiles.readW());
+	writer.put(tiles.readH());
+	unsigned regionsOffsetAt=writer.bytes.size();
+	writer.put(0u);//where the regions start, known once the rest of the header is written
+	writer.put(unsigned(world.caves.size()));
+	for(unsigned i=0; i<world.caves.size(); ++i){
+		const Cave& cave=world.caves[i];
+		writer.put(cave.xi);
+		writer.put(cave.yi);
+		writer.put(cave.xf);
+		writer.put(cave.yf);
+		writer.put(cave.size);
+		writer.put(unsigned(cave.platforms));
+		writer.put(cave.depth);
+		writer.put(cave.parent);
+		writer.put(cave.connectionY);
+		writer.put(unsigned(cave.children.size()));
+		for(unsigned j=0; j<cave.children.size(); ++j) writer.put(cave.children[j]);
+	}
+	writer.put(world.playerCave);
+	writer.put(world.caveRejections);
+	writer.put(world.playerX);
+	writer.put(world.playerY);
+	writer.put(world.buddyX);
+	writer.put(world.buddyY);
+	writer.put(world.scubaX);
+	writer.put(world.scubaY);
+	writer.put(unsigned(world.hiJumps.size()));
+	for(unsigned i=0; i<world.hiJumps.size(); ++i){
+		writer.put(world.hiJumps[i].first);
+		writer.put(world.hiJumps[i].second);
+	}
+	unsigned regionsOffset=
+		(writer.bytes.size()+MappedFile::ALIGNMENT-1)/MappedFile::ALIGNMENT*MappedFile::ALIGNMENT;
+	writer.putAt(regionsOffsetAt, regionsOffset);
+	writer.bytes.resize(regionsOffset, 0);
+	//write to a temporary file and rename it, so a crash can't leave half a world behind
+	string temporaryFileName=fileName+".part";
+	FILE* file=fopen(temporaryFileName.c_str(), "wb");
+	if(!file) return false;
+	bool written=fwrite(&writer.bytes[0], 1, writer.bytes.size(), file)==writer.bytes.size();
+	//a region at a time, so saving doesn't need a second copy of the map
+	unsigned chunksW=(tiles.readW()+CHUNK_SIZE-1)/CHUNK_SIZE, chunksH=tiles.readChunksH();
+	vector<unsigned char> region(REGION_BYTES);
+	for(unsigned rx=0; written&&rx*REGION_CHUNKS<chunksW; ++rx)
+		for(unsigned ry=0; written&&ry*REGION_CHUNKS<chunksH; ++ry){
+			fill(region.begin(), region.begin()+REGION_TYPE_BYTES, WALL|WALL<<2|WALL<<4|WALL<<6);
+			fill(region.begin()+REGION_TYPE_BYTES, region.end(), 0);
+			for(unsigned i=0; i<REGION_CHUNKS&&rx*REGION_CHUNKS+i<chunksW; ++i)
+				for(unsigned j=0; j<REGION_CHUNKS&&ry*REGION_CHUNKS+j<chunksH; ++j){
+					unsigned cx=rx*REGION_CHUNKS+i, cy=ry*REGION_CHUNKS+j;
+					unsigned chunk=i*REGION_CHUNKS+j;
+					const unsigned char* types=tiles.readChunkTypes(cx, cy);
+					const unsigned char* insets=tiles.readChunkInsets(cx, cy);
+					copy(types, types+CHUNK_TYPE_BYTES, region.begin()+chunk*CHUNK_TYPE_BYTES);
+					copy(
+						insets, insets+CHUNK_INSET_BYTES,
+						region.begin()+REGION_TYPE_BYTES+chunk*CHUNK_INSET_BYTES
+					);
+				}
+			written=fwrite(&region[0], 1, region.size(), file)==region.size();
+		}
+	if(fclose(file)!=0) written=false;
+	if(!written||!replaceFile(temporaryFileName, fileName)){
+		remove(temporaryFileName.c_str());
+		return false;
+	}
+	return true;
+}
+
+//Reads everything but the tiles. The header is small, so it's just read.
+bool loadWorldHeader(
+	World& world, const string& fileName,
+	unsigned seed, unsigned width, unsigned height, unsigned& regionsOffset
+){
+	FILE* file=fopen(fileName.c_str(), "rb");
+	if(!file) return false;
+	vector<unsigned char> fixed(7*4);
+	bool read=fread(&fixed[0], 1, fixed.size(), file)==fixed.size();
+	Reader fixedReader(&fixed[0], fixed.size());
+	unsigned magic, format, version, fileSeed, w, h;
+	read=read
+		&&fixedReader.get(magic)&&magic==MAGIC
+		&&fixedReader.get(format)&&format==FORMAT_VERSION
+		&&fixedReader.get(version)&&version==GENERATOR_VERSION
+		&&fixedReader.get(fileSeed)&&fileSeed==seed
+		&&fixedReader.get(w)&&w==width
+		&&fixedReader.get(h)&&h==height
+		&&fixedReader.get(regionsOffset)&&regionsOffset>=fixed.size()
+	;
+	vector<unsigned char> header;
+	if(read){
+		header.resize(regionsOffset-fixed.size());
+		read=fread(&header[0], 1, header.size(), file)==header.size();
+	}
+	fclose(file);
+	if(!read) return false;
+	Reader reader(&header[0], header.size());
+	unsigned caves;
+	if(!reader.get(caves)||caves>header.size()) return false;
+	world.caves.clear();
+	for(unsigned i=0; i<caves; ++i){
+		unsigned xi, yi, xf, yf, platforms, children;
+		float size;
+		int depth;
+		if(
+			!reader.get(xi)||!reader.get(yi)||!reader.get(xf)||!reader.get(yf)
+			||
+			!reader.get(size)||!reader.get(platforms)||!reader.get(depth)
+		) return false;
+		world.caves.push_back(Cave(xi, yi, xf, yf, size, platforms!=0, depth));
+		Cave& cave=world.caves.back();
+		if(!reader.get(cave.parent)||!reader.get(cave.connectionY)) return false;
+		if(!reader.get(children)||children>header.size()) return false;
+		cave.children.resize(children);
+		for(unsigned j=0; j<children; ++j)
+			if(!reader.get(cave.children[j])) return false;
+	}
+	unsigned hiJumps;
+	if(
+		!reader.get(world.playerCave)||!reader.get(world.caveRejections)
+		||
+		!reader.get(world.playerX)||!reader.get(world.playerY)
+		||
+		!reader.get(world.buddyX)||!reader.get(world.buddyY)
+		||
+		!reader.get(world.scubaX)||!reader.get(world.scubaY)
+		||
+		!reader.get(hiJumps)||hiJumps>header.size()
+	) return false;
+	world.hiJumps.resize(hiJumps);
+	for(unsigned i=0; i<hiJumps; ++i)
+		if(!reader.get(world.hiJumps[i].first)||!reader.get(world.hiJumps[i].second))
+			return false;
+	world.seed=seed;
+	return true;
+}
+
+bool loadWorld(
+	World& world, const string& fileName,
+	unsigned seed, unsigned width, unsigned height
+){
+	unsigned regionsOffset;
+	if(!loadWorldHeader(world, fileName, seed, width, height, regionsOffset)) return false;
+	//copy the tiles in through a stream that only keeps one region mapped,
+	//the file itself is only mapped as it's played when the caller streams the world instead
+	TileStream stream(1);
+	if(!stream.open(fileName, width, height, regionsOffset)) return false;
+	world.tiles.resize(width, height);
+	unsigned chunksW=(width+CHUNK_SIZE-1)/CHUNK_SIZE, chunksH=world.tiles.readChunksH();
+	for(unsigned cx=0; cx<chunksW; ++cx){
+		for(unsigned cy=0; cy<chunksH; ++cy)
+			world.tiles.writeChunk(
+				cx, cy, stream.getChunkTypes(cx, cy), stream.getChunkInsets(cx, cy)
+			);
+		stream.keepResident(-2, -2, -1, -1);
+	}
+	return true;
+}
+
+bool streamWorld(
+	World& world, TileStream& stream, const string& fileName,
+	unsigned seed, unsigned width, unsigned height
+){
+	unsigned regionsOffset;
+	if(!loadWorldHeader(world, fileName, seed, width, height, regionsOffset)) return false;
+	if(!stream.open(fileName, width, height, regionsOffset)) return false;
+	world.tiles.streamFrom(&stream);
+	return true;
+}
+
+void loadOrGenerateWorlds(
+	vector<World>& worlds, const vector<unsigned>& seeds,
+	unsigned width, unsigned height, const string& cacheDirectory, ThreadPool& pool,
+	vector<TileStream*>* streams
+){
+	worlds.resize(seeds.size());
+	if(streams)
+		for(unsigned i=0; i<seeds.size(); ++i) streams->push_back(new TileStream);
+	vector<unsigned> missing;
+	vector<unsigned> missingSeeds;
+	for(unsigned i=0; i<seeds.size(); ++i){
+		string fileName=getWorldCacheFileName(cacheDirectory, seeds[i], width, height);
+		bool loaded;
+		if(streams) loaded=streamWorld(worlds[i], *(*streams)[i], fileName, seeds[i], width, height);
+		else loaded=loadWorld(worlds[i], fileName, seeds[i], width, height);
+		if(!loaded){
+			missing.push_back(i);
+			missingSeeds.push_back(seeds[i]);
+		}
+	}
+	if(missing.empty()) return;
+	vector<World> generated;
+	generateWorlds(generated, missingSeeds, width, height, pool);
+	for(unsigned i=0; i<missing.size(); ++i){
+		string fileName=getWorldCacheFileName(cacheDirectory, missingSeeds[i], width, height);
+		bool saved=saveWorld(generated[i], fileName);
+		World& world=worlds[missing[i]];
+		//keep the generated one if it can't be streamed back
+		if(
+			!streams||!saved
+			||
+			!streamWorld(world, *(*streams)[missing[i]], fileName, missingSeeds[i], width, height)
+		)
+			world=generated[i];
+		generated[i]=World();//done with it, so free it now instead of after the rest are saved
+	}
+}
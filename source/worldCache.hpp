@@ -0,0 +1,40 @@
+#ifndef WORLDCACHE_HPP_INCLUDED
+#define WORLDCACHE_HPP_INCLUDED
+
+#include "tileStream.hpp"
+#include "world.hpp"
+
+#include <string>
+#include <vector>
+
+//Worlds are saved in a compact little endian binary file, one per seed, size and
+//generator version. A header with the cave graph and where everything was placed is
+//followed by the tiles in regions, laid out as TileStream reads them.
+//The planned holes of caves aren't kept.
+//The directory is empty for the working directory, or ends in a path separator.
+std::string getWorldCacheFileName(
+	const std::string& directory, unsigned seed, unsigned width, unsigned height
+);
+bool saveWorld(const World& world, const std::string& fileName);
+//These fail if the file is missing, damaged, or not for this seed, size and generator version.
+//copies every tile into memory, so only suits worlds small enough to keep there
+bool loadWorld(
+	World& world, const std::string& fileName,
+	unsigned seed, unsigned width, unsigned height
+);
+//leaves the tiles in the file, read through the stream as they're needed
+bool streamWorld(
+	World& world, TileStream& stream, const std::string& fileName,
+	unsigned seed, unsigned width, unsigned height
+);
+
+//Loads each world from the cache in the directory if it's there, generates and saves the rest.
+//Given streams, a stream is made for each world, for the caller to delete after the worlds,
+//and worlds are streamed from their files instead of loaded.
+void loadOrGenerateWorlds(
+	std::vector<World>& worlds, const std::vector<unsigned>& seeds,
+	unsigned width, unsigned height, const std::string& cacheDirectory, ThreadPool& pool,
+	std::vector<TileStream*>* streams=NULL
+);
+
+#endif